@@ -0,0 +1,915 @@
+/**
+ * Hackemu is an emulator of the Hack computer (CPU, ROM32K, RAM16K,
+ * screen and keyboard) that runs the .hack output of the assembler.
+ *
+ * To compile:
+ * g++ hackemu.cpp -std=c++17 -Wall -O2 -ldl -o hackemu
+ *
+ * Usage:
+ * hackemu [-n|-t] [-v] [-s] [-c cycles] [-r addr=value]... [-d from-to]... [-p screen.pbm] file.hack
+ *   -n  naive interpreter decoding every instruction on each cycle
+ *   -t  translate the ROM to native code before running it
+ *   -v  run the interpreter again and check the final RAM and registers
+ *   -s  print statistics (cycles, elapsed time, cycles per second)
+ *   -c  stop after that many cycles (default: run until the program halts)
+ *   -r  set a RAM word before running, e.g. -r 24576=65 presses 'A'
+ *   -d  dump RAM[from] .. RAM[to] after running
+ *   -p  write the screen to a PBM image after running
+ *
+ * A file ending in .bin is loaded as the packed little-endian image
+ * written by hacker -b. The program halts when the program counter runs
+ * past the end of the program, or on the usual end of program idiom
+ * "(END) @END 0;JMP".
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <sstream>
+#include <cstdio>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+namespace hackemu {
+
+	constexpr uint16_t rom_size = 0x8000;
+	constexpr uint16_t ram_size = 0x8000;
+	constexpr uint16_t screen = 0x4000;
+	constexpr uint16_t screen_size = 0x2000;
+	constexpr uint16_t keyboard = 0x6000;
+
+	/**
+	 * Loads a ROM image, either the .hack text (one line of 16 ASCII
+	 * digits per word) or a packed little-endian binary image.
+	 */
+	inline std::vector<uint16_t> load_rom(const std::string &file)
+	{
+		std::ifstream ifs(file, std::ifstream::in | std::ifstream::binary);
+		if (!ifs)
+			throw std::runtime_error("cannot open " + file);
+
+		std::vector<uint16_t> rom;
+		std::string::size_type dot = file.rfind(".");
+
+		if (dot != std::string::npos && file.substr(dot) == ".bin") {
+			std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+			if (data.size() % 2)
+				throw std::runtime_error(file + ": odd binary image size");
+			for (std::size_t i = 0; i < data.size(); i += 2)
+				rom.push_back(static_cast<uint8_t>(data[i]) | static_cast<uint8_t>(data[i + 1]) << 8);
+		} else {
+			std::string line;
+			std::size_t line_num = 0;
+			while (std::getline(ifs, line)) {
+				line_num++;
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				if (line.empty())
+					continue;
+
+				if (line.size() != 16 || line.find_first_not_of("01") != std::string::npos)
+					throw std::runtime_error(file + ":" + std::to_string(line_num) + ": invalid instruction");
+				rom.push_back(std::stoul(line, nullptr, 2));
+			}
+		}
+
+		if (rom.size() > rom_size)
+			throw std::runtime_error(file + ": program does not fit in ROM32K");
+		return rom;
+	}
+
+/**
+ * ALU operations (a c1c2c3c4c5c6) of the C-instructions the assembler
+ * knows, with the value they compute from the locals a, d and ram.
+ */
+#define HACKEMU_COMPS(X) \
+	X(zero,    0b0101010, 0) \
+	X(one,     0b0111111, 1) \
+	X(minus1,  0b0111010, 0xFFFF) \
+	X(d,       0b0001100, d) \
+	X(a,       0b0110000, a) \
+	X(not_d,   0b0001101, ~d) \
+	X(not_a,   0b0110001, ~a) \
+	X(neg_d,   0b0001111, -d) \
+	X(neg_a,   0b0110011, -a) \
+	X(d_inc,   0b0011111, d + 1) \
+	X(a_inc,   0b0110111, a + 1) \
+	X(d_dec,   0b0001110, d - 1) \
+	X(a_dec,   0b0110010, a - 1) \
+	X(d_add_a, 0b0000010, d + a) \
+	X(d_sub_a, 0b0010011, d - a) \
+	X(a_sub_d, 0b0000111, a - d) \
+	X(d_and_a, 0b0000000, d & a) \
+	X(d_or_a,  0b0010101, d | a) \
+	X(m,       0b1110000, ram[a & 0x7FFF]) \
+	X(not_m,   0b1110001, ~ram[a & 0x7FFF]) \
+	X(neg_m,   0b1110011, -ram[a & 0x7FFF]) \
+	X(m_inc,   0b1110111, ram[a & 0x7FFF] + 1) \
+	X(m_dec,   0b1110010, ram[a & 0x7FFF] - 1) \
+	X(d_add_m, 0b1000010, d + ram[a & 0x7FFF]) \
+	X(d_sub_m, 0b1010011, d - ram[a & 0x7FFF]) \
+	X(m_sub_d, 0b1000111, ram[a & 0x7FFF] - d) \
+	X(d_and_m, 0b1000000, d & ram[a & 0x7FFF]) \
+	X(d_or_m,  0b1010101, d | ram[a & 0x7FFF])
+
+/**
+ * Destination masks (d1d2d3), each one expanded into its own handler.
+ */
+#define HACKEMU_DESTS(X) X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7)
+
+	/**
+	 * ROM word decoded once at load time. The dispatch loop jumps on op
+	 * to compute the ALU output and then on write to store it and take
+	 * the jump, without looking at the instruction bits again.
+	 */
+	struct uop {
+		uint8_t op;     // op_load, one of HACKEMU_COMPS, op_alu, ...
+		uint8_t write;  // destination mask, | 8 if the instruction can jump
+		uint8_t jump;   // j1j2j3: jump if out < 0, out == 0, out > 0
+		uint16_t value; // A-instruction constant or the whole C-instruction
+	};
+
+	enum op : uint8_t {
+		op_load,     // A-instruction
+#define HACKEMU_OP(name, bits, expr) op_##name,
+		HACKEMU_COMPS(HACKEMU_OP)
+#undef HACKEMU_OP
+		op_alu,      // C-instruction with a comp field not listed above
+		op_halt_jmp, // 0;JMP that may be the end of program loop
+		op_end,      // past the end of the program
+	};
+
+	// ALU as wired in projects/02/ALU.hdl, for any comp field
+	inline uint16_t alu(uint16_t instruction, uint16_t x, uint16_t y)
+	{
+		uint16_t out;
+
+		if (instruction & 0x0800) // zx
+			x = 0;
+		if (instruction & 0x0400) // nx
+			x = ~x;
+		if (instruction & 0x0200) // zy
+			y = 0;
+		if (instruction & 0x0100) // ny
+			y = ~y;
+		if (instruction & 0x0080) // f
+			out = x + y;
+		else
+			out = x & y;
+		if (instruction & 0x0040) // no
+			out = ~out;
+
+		return out;
+	}
+
+	/**
+	 * Ahead of time translation of a ROM image into host code. The ROM is
+	 * split into basic blocks at jumps and at the targets of jumps whose
+	 * A value is a known constant. Every block becomes straight-line C++
+	 * with A, D and the RAM base in locals, which is compiled into a
+	 * shared object with the system compiler ($CXX, c++ by default) and
+	 * loaded with dlopen().
+	 *
+	 * Constant jump targets are direct gotos between blocks. Jumps to a
+	 * computed A go through a switch over the block addresses, which the
+	 * compiler turns into a lookup table. Every constant that fits in
+	 * the program starts a block too, since that is how return addresses
+	 * get passed around. A computed jump into the middle of a block
+	 * returns to the interpreter, which runs up to the next block.
+	 *
+	 * Every block charges its length to the cycle budget on entry. When
+	 * the budget is too small for a block, the translated code returns
+	 * and the interpreter runs the last few cycles, so cycle limits are
+	 * exact.
+	 */
+	class translation {
+	public:
+		enum result {
+			halted = 0,
+			out_of_budget = 1,
+			not_a_block = 2,
+		};
+
+		using function = int (*)(uint16_t *ram, uint16_t *registers, uint64_t *budget);
+
+		translation(const std::vector<uint16_t> &rom)
+			: m_rom(rom),
+			  m_leader(rom.size() + 1, false)
+		{
+			find_leaders();
+			compile(source());
+		}
+
+		~translation()
+		{
+			if (m_handle)
+				::dlclose(m_handle);
+		}
+
+		translation(const translation &) = delete;
+		translation &operator=(const translation &) = delete;
+
+		function entry() const
+		{
+			return m_function;
+		}
+
+		std::size_t blocks() const
+		{
+			return std::count(m_leader.begin(), m_leader.end() - 1, true);
+		}
+
+		bool leader(uint16_t pc) const
+		{
+			return pc >= m_rom.size() || m_leader[pc];
+		}
+
+		std::string source() const
+		{
+			std::ostringstream oss;
+			std::size_t size = m_rom.size();
+
+			oss << "#include <cstdint>\n"
+			    << "static inline uint16_t alu(uint16_t i, uint16_t x, uint16_t y)\n"
+			    << "{\n"
+			    << "\tif (i & 0x0800) x = 0;\n"
+			    << "\tif (i & 0x0400) x = ~x;\n"
+			    << "\tif (i & 0x0200) y = 0;\n"
+			    << "\tif (i & 0x0100) y = ~y;\n"
+			    << "\tuint16_t out = (i & 0x0080) ? x + y : x & y;\n"
+			    << "\treturn (i & 0x0040) ? ~out : out;\n"
+			    << "}\n"
+			    << "extern \"C\" int hack_run(uint16_t *ram, uint16_t *registers, uint64_t *budget_p)\n"
+			    << "{\n"
+			    << "\tuint16_t a = registers[0], d = registers[1], pc = registers[2], out, target;\n"
+			    << "\tuint64_t budget = *budget_p;\n"
+			    << "\tint result = " << halted << ";\n"
+			    << "\t(void)out; (void)target;\n"
+			    << "dispatch:\n"
+			    << "\tswitch (pc) {\n";
+
+			for (std::size_t pc = 0; pc < size; pc++)
+				if (m_leader[pc])
+					oss << "\tcase " << pc << ": goto b" << pc << ";\n";
+			oss << "\tdefault:\n"
+			    << "\t\tif (pc < " << size << ") { result = " << not_a_block << "; goto done; }\n"
+			    << "\t\tgoto done;\n"
+			    << "\t}\n";
+
+			int32_t known_a = -1;
+			for (std::size_t pc = 0; pc < size; pc++) {
+				if (m_leader[pc]) {
+					std::size_t end = pc + 1;
+					while (!m_leader[end])
+						end++;
+
+					known_a = -1;
+					oss << "b" << pc << ":\n"
+					    << "\tif (budget < " << end - pc << ") { pc = " << pc << "; goto out_of_budget; }\n"
+					    << "\tbudget -= " << end - pc << ";\n";
+				}
+				translate(oss, pc, known_a);
+			}
+
+			oss << "b" << size << ":\n"
+			    << "\tpc = " << size << ";\n"
+			    << "\tgoto done;\n"
+			    << "out_of_budget:\n"
+			    << "\tresult = " << out_of_budget << ";\n"
+			    << "done:\n"
+			    << "\tregisters[0] = a; registers[1] = d; registers[2] = pc;\n"
+			    << "\t*budget_p = budget;\n"
+			    << "\treturn result;\n"
+			    << "}\n";
+
+			return oss.str();
+		}
+
+	private:
+		static bool jumps(uint16_t instruction)
+		{
+			return (instruction & 0x8000) && (instruction & 0x0007);
+		}
+
+		static const char *jump_condition(uint16_t instruction)
+		{
+			static const char *const conditions[] = {
+				"false", "(int16_t)out > 0", "out == 0", "(int16_t)out >= 0",
+				"(int16_t)out < 0", "out != 0", "(int16_t)out <= 0", "true",
+			};
+			return conditions[instruction & 0x0007];
+		}
+
+		// "@END 0;JMP" jumping back onto its own A-instruction
+		bool halt_loop(std::size_t pc) const
+		{
+			return m_rom[pc] == 0xEA87 && pc > 0 && m_rom[pc - 1] == pc - 1;
+		}
+
+		void find_leaders()
+		{
+			int32_t known_a = -1;
+
+			m_leader[0] = true;
+			m_leader[m_rom.size()] = true;
+			for (std::size_t pc = 0; pc < m_rom.size(); pc++) {
+				uint16_t instruction = m_rom[pc];
+
+				if (m_leader[pc])
+					known_a = -1;
+
+				if (!(instruction & 0x8000)) {
+					known_a = instruction;
+					if (instruction < m_rom.size())
+						m_leader[instruction] = true;
+					continue;
+				}
+
+				if (jumps(instruction)) {
+					m_leader[pc + 1] = true;
+					if (known_a >= 0 && static_cast<std::size_t>(known_a) < m_rom.size())
+						m_leader[known_a] = true;
+				}
+
+				if (instruction & 0x0020)
+					known_a = -1;
+			}
+		}
+
+		void translate(std::ostringstream &oss, std::size_t pc, int32_t &known_a) const
+		{
+			uint16_t instruction = m_rom[pc];
+
+			if (!(instruction & 0x8000)) {
+				oss << "\ta = " << instruction << ";\n";
+				known_a = instruction;
+				return;
+			}
+
+			switch ((instruction >> 6) & 0x7F) {
+#define HACKEMU_OP(name, bits, expr) case bits: oss << "\tout = (uint16_t)(" #expr ");\n"; break;
+			HACKEMU_COMPS(HACKEMU_OP)
+#undef HACKEMU_OP
+			default:
+				oss << "\tout = alu(" << instruction << ", d, "
+				    << ((instruction & 0x1000) ? "ram[a & 0x7FFF]" : "a") << ");\n";
+			}
+
+			if (instruction & 0x0008)
+				oss << "\tram[a & 0x7FFF] = out;\n";
+			if (instruction & 0x0010)
+				oss << "\td = out;\n";
+			if (jumps(instruction))
+				oss << "\ttarget = a;\n";
+			if (instruction & 0x0020)
+				oss << "\ta = out;\n";
+
+			if (jumps(instruction)) {
+				oss << "\tif (" << jump_condition(instruction) << ") {\n";
+				if (halt_loop(pc))
+					oss << "\t\tif (target + 1 == " << pc << ") { pc = " << pc << "; goto done; }\n";
+
+				int32_t target = known_a >= 0 ? (known_a & 0x7FFF) : -1;
+				if (target >= 0 && static_cast<std::size_t>(target) < m_rom.size() && m_leader[target])
+					oss << "\t\tgoto b" << target << ";\n";
+				else if (target >= 0 && static_cast<std::size_t>(target) >= m_rom.size())
+					oss << "\t\tpc = " << target << "; goto done;\n";
+				else
+					oss << "\t\tpc = target & 0x7FFF; goto dispatch;\n";
+				oss << "\t}\n";
+			}
+
+			if (instruction & 0x0020)
+				known_a = -1;
+		}
+
+		void compile(const std::string &source)
+		{
+			char dir[] = "/tmp/hackemu.XXXXXX";
+			if (!::mkdtemp(dir))
+				throw std::runtime_error("cannot create a temporary directory");
+
+			std::string cpp_file = std::string(dir) + "/rom.cpp";
+			std::string so_file = std::string(dir) + "/rom.so";
+			std::ofstream(cpp_file) << source;
+
+			const char *cxx = std::getenv("CXX");
+			std::string command = std::string(cxx ? cxx : "c++") +
+			                      " -std=c++11 -O1 -shared -fPIC -w -o " + so_file + " " + cpp_file;
+			int status = std::system(command.c_str());
+
+			if (status == 0)
+				m_handle = ::dlopen(so_file.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+			std::remove(cpp_file.c_str());
+			std::remove(so_file.c_str());
+			::rmdir(dir);
+
+			if (status != 0)
+				throw std::runtime_error("failed to compile the translated ROM: " + command);
+			if (!m_handle)
+				throw std::runtime_error(std::string("cannot load the translated ROM: ") + ::dlerror());
+
+			m_function = reinterpret_cast<function>(::dlsym(m_handle, "hack_run"));
+			if (!m_function)
+				throw std::runtime_error("translated ROM has no entry point");
+		}
+
+		std::vector<uint16_t> m_rom;
+		std::vector<bool> m_leader;
+		void *m_handle = nullptr;
+		function m_function = nullptr;
+	};
+
+	/**
+	 * The Hack CPU with its memory. run() dispatches over ROM words
+	 * decoded at load time. run_naive() fetches an instruction every
+	 * cycle and decodes its fields the same way projects/05/CPU.hdl
+	 * does.
+	 */
+	class computer {
+	public:
+		enum class status {
+			running,
+			halted,
+			cycle_limit,
+		};
+
+		computer(const std::vector<uint16_t> &rom)
+			: m_rom(rom_size, 0),
+			  m_ram(ram_size, 0),
+			  m_code(rom_size),
+			  m_program_size(rom.size())
+		{
+			std::copy(rom.begin(), rom.end(), m_rom.begin());
+			for (std::size_t pc = 0; pc < rom_size; pc++)
+				m_code[pc] = decode(pc);
+		}
+
+		void reset()
+		{
+			m_pc = 0;
+			m_cycles = 0;
+		}
+
+		/**
+		 * Runs until the program halts or max_cycles instructions were
+		 * executed in total (0 means no limit).
+		 */
+		status run(uint64_t max_cycles)
+		{
+			static const void *const ops[] = {
+				&&op_load,
+#define HACKEMU_OP(name, bits, expr) &&op_##name,
+				HACKEMU_COMPS(HACKEMU_OP)
+#undef HACKEMU_OP
+				&&op_alu,
+				&&op_halt_jmp,
+				&&op_end,
+			};
+			static const void *const writes[] = {
+#define HACKEMU_WRITE(dest) &&write_##dest,
+				HACKEMU_DESTS(HACKEMU_WRITE)
+#undef HACKEMU_WRITE
+#define HACKEMU_WRITE(dest) &&write_jump_##dest,
+				HACKEMU_DESTS(HACKEMU_WRITE)
+#undef HACKEMU_WRITE
+			};
+
+			const uop *code = m_code.data();
+			uint16_t *ram = m_ram.data();
+			uint16_t a = m_a, d = m_d, pc = m_pc;
+			uint64_t budget = max_cycles ? (max_cycles > m_cycles ? max_cycles - m_cycles : 0) : UINT64_MAX;
+			uint64_t start_budget = budget;
+			status s = status::cycle_limit;
+			const uop *u;
+			uint16_t out = 0;
+
+#define HACKEMU_NEXT() \
+	do { \
+		if (budget == 0) \
+			goto done; \
+		budget--; \
+		u = &code[pc]; \
+		goto *ops[u->op]; \
+	} while (0)
+
+// stores out according to the constant destination mask; M uses the old A
+#define HACKEMU_STORE(dest) \
+	do { \
+		if ((dest) & 1) \
+			ram[a & 0x7FFF] = out; \
+		if ((dest) & 2) \
+			d = out; \
+		if ((dest) & 4) \
+			a = out; \
+	} while (0)
+
+			HACKEMU_NEXT();
+
+		op_load:
+			a = u->value;
+			pc++;
+			HACKEMU_NEXT();
+
+#define HACKEMU_OP(name, bits, expr) \
+		op_##name: \
+			out = (expr); \
+			goto *writes[u->write];
+			HACKEMU_COMPS(HACKEMU_OP)
+#undef HACKEMU_OP
+
+		op_alu:
+			out = alu(u->value, d, (u->value & 0x1000) ? ram[a & 0x7FFF] : a);
+			goto *writes[u->write];
+
+#define HACKEMU_WRITE(dest) \
+		write_##dest: \
+			HACKEMU_STORE(dest); \
+			pc++; \
+			HACKEMU_NEXT(); \
+		write_jump_##dest: \
+			{ \
+				uint16_t target = a; \
+				HACKEMU_STORE(dest); \
+				uint8_t sign = (static_cast<int16_t>(out) < 0) << 2 | (out == 0) << 1 | \
+				               (static_cast<int16_t>(out) > 0); \
+				pc = (u->jump & sign) ? (target & 0x7FFF) : pc + 1; \
+			} \
+			HACKEMU_NEXT();
+			HACKEMU_DESTS(HACKEMU_WRITE)
+#undef HACKEMU_WRITE
+
+		op_halt_jmp:
+			if (a + 1 == pc) {
+				s = status::halted;
+				goto done;
+			}
+			pc = a & 0x7FFF;
+			HACKEMU_NEXT();
+
+		op_end:
+			budget++; // not executed
+			s = status::halted;
+
+#undef HACKEMU_STORE
+#undef HACKEMU_NEXT
+
+		done:
+			m_a = a;
+			m_d = d;
+			m_pc = pc;
+			m_cycles += start_budget - budget;
+			return s;
+		}
+
+		/**
+		 * Same as run(), decoding the instruction fields on every cycle.
+		 */
+		status run_naive(uint64_t max_cycles)
+		{
+			const uint16_t *rom = m_rom.data();
+			uint16_t *ram = m_ram.data();
+			uint16_t a = m_a, d = m_d, pc = m_pc;
+			uint64_t cycles = m_cycles;
+			uint64_t limit = max_cycles ? max_cycles : UINT64_MAX;
+			status s = status::cycle_limit;
+
+			while (cycles < limit) {
+				if (pc >= m_program_size) {
+					s = status::halted;
+					break;
+				}
+
+				uint16_t instruction = rom[pc];
+				cycles++;
+
+				// A-instruction
+				if (!(instruction & 0x8000)) {
+					a = instruction;
+					pc++;
+					continue;
+				}
+
+				// C-instruction: 111a c1c2c3c4c5c6 d1d2d3 j1j2j3
+				uint16_t out = alu(instruction, d, (instruction & 0x1000) ? ram[a & 0x7FFF] : a);
+
+				if (instruction & 0x0008) // d3: M
+					ram[a & 0x7FFF] = out;
+				if (instruction & 0x0010) // d2: D
+					d = out;
+
+				bool jump = ((instruction & 0x0004) && static_cast<int16_t>(out) < 0) ||
+				            ((instruction & 0x0002) && out == 0) ||
+				            ((instruction & 0x0001) && static_cast<int16_t>(out) > 0);
+				uint16_t target = a;
+
+				if (instruction & 0x0020) // d1: A
+					a = out;
+
+				if (jump) {
+					if (halt_loop(pc, target)) {
+						s = status::halted;
+						break;
+					}
+					pc = target & 0x7FFF;
+				} else
+					pc++;
+			}
+
+			m_a = a;
+			m_d = d;
+			m_pc = pc;
+			m_cycles = cycles;
+			return s;
+		}
+
+		/**
+		 * Same as run(), executing the translated ROM. Jumps into the
+		 * middle of a block and the last cycles before the limit that do
+		 * not make up a whole block are left to the interpreter.
+		 */
+		status run_translated(const translation &t, uint64_t max_cycles)
+		{
+			for (;;) {
+				uint64_t budget = max_cycles ? (max_cycles > m_cycles ? max_cycles - m_cycles : 0) : UINT64_MAX;
+				uint16_t registers[3] = {m_a, m_d, m_pc};
+				uint64_t start_budget = budget;
+
+				int result = t.entry()(m_ram.data(), registers, &budget);
+
+				m_a = registers[0];
+				m_d = registers[1];
+				m_pc = registers[2];
+				m_cycles += start_budget - budget;
+
+				if (result == translation::halted)
+					return status::halted;
+				if (result == translation::out_of_budget)
+					return run(max_cycles);
+
+				do {
+					if (max_cycles && m_cycles >= max_cycles)
+						return status::cycle_limit;
+					if (run(m_cycles + 1) == status::halted)
+						return status::halted;
+				} while (!t.leader(m_pc));
+			}
+		}
+
+		const std::vector<uint16_t> &memory() const
+		{
+			return m_ram;
+		}
+
+		uint16_t &ram(uint16_t address)
+		{
+			return m_ram[address & 0x7FFF];
+		}
+
+		uint16_t a() const
+		{
+			return m_a;
+		}
+
+		uint16_t d() const
+		{
+			return m_d;
+		}
+
+		uint16_t pc() const
+		{
+			return m_pc;
+		}
+
+		uint64_t cycles() const
+		{
+			return m_cycles;
+		}
+
+		void write_screen(const std::string &file) const
+		{
+			std::ofstream ofs(file, std::ofstream::out | std::ofstream::binary);
+			if (!ofs)
+				throw std::runtime_error("cannot create " + file);
+
+			// 512x256 pixels, bit 0 of a word is its leftmost pixel
+			ofs << "P4\n512 256\n";
+			for (uint16_t i = 0; i < screen_size; i++) {
+				uint16_t word = m_ram[screen + i];
+				uint8_t bytes[2] = {0, 0};
+				for (int bit = 0; bit < 16; bit++)
+					if (word & (1 << bit))
+						bytes[bit / 8] |= 0x80 >> (bit % 8);
+				ofs.write(reinterpret_cast<const char *>(bytes), 2);
+			}
+		}
+
+	private:
+		uop decode(uint16_t pc) const
+		{
+			uint16_t instruction = m_rom[pc];
+			uop u = {op_alu, 0, 0, instruction};
+
+			if (pc >= m_program_size) {
+				u.op = op_end;
+				return u;
+			}
+
+			if (!(instruction & 0x8000)) {
+				u.op = op_load;
+				return u;
+			}
+
+			switch ((instruction >> 6) & 0x7F) {
+#define HACKEMU_OP(name, bits, expr) case bits: u.op = op_##name; break;
+			HACKEMU_COMPS(HACKEMU_OP)
+#undef HACKEMU_OP
+			}
+
+			u.jump = instruction & 0x0007;
+			u.write = ((instruction >> 3) & 0x0007) | (u.jump ? 8 : 0);
+
+			if (instruction == 0xEA87 && pc > 0 && m_rom[pc - 1] == pc - 1)
+				u.op = op_halt_jmp;
+
+			return u;
+		}
+
+		// "@END 0;JMP" jumping back onto its own A-instruction
+		bool halt_loop(uint16_t pc, uint16_t target) const
+		{
+			return m_rom[pc] == 0xEA87 && target + 1 == pc && m_rom[target] == target;
+		}
+
+		std::vector<uint16_t> m_rom;
+		std::vector<uint16_t> m_ram;
+		std::vector<uop> m_code;
+		std::size_t m_program_size;
+		uint16_t m_a = 0;
+		uint16_t m_d = 0;
+		uint16_t m_pc = 0;
+		uint64_t m_cycles = 0;
+	};
+
+} // namespace hackemu
+
+static void abort_with_usage(const char *argv0)
+{
+	std::cerr << "usage: " << argv0
+	          << " [-n|-t] [-v] [-s] [-c cycles] [-r addr=value]... [-d from-to]... [-p screen.pbm] file.hack"
+	          << std::endl;
+	std::abort();
+}
+
+static bool parse_pair(const char *arg, char separator, unsigned long *first, unsigned long *second)
+{
+	char *end;
+	*first = std::strtoul(arg, &end, 0);
+	if (end == arg || *end != separator)
+		return false;
+
+	arg = end + 1;
+	*second = std::strtoul(arg, &end, 0);
+	return end != arg && *end == '\0';
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<std::pair<unsigned long, unsigned long>> pokes;
+	std::vector<std::pair<unsigned long, unsigned long>> dumps;
+	std::string screen_file;
+	uint64_t max_cycles = 0;
+	bool naive = false;
+	bool translate = false;
+	bool verify = false;
+	bool stats = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "ntvsc:r:d:p:")) != -1) {
+		unsigned long first, second;
+
+		switch (opt) {
+		case 'n':
+			naive = true;
+			break;
+		case 't':
+			translate = true;
+			break;
+		case 'v':
+			verify = true;
+			break;
+		case 's':
+			stats = true;
+			break;
+		case 'c':
+			max_cycles = std::strtoull(optarg, nullptr, 0);
+			break;
+		case 'r':
+			if (!parse_pair(optarg, '=', &first, &second))
+				abort_with_usage(argv[0]);
+			pokes.emplace_back(first, second);
+			break;
+		case 'd':
+			if (!parse_pair(optarg, '-', &first, &second))
+				abort_with_usage(argv[0]);
+			dumps.emplace_back(first, second);
+			break;
+		case 'p':
+			screen_file = optarg;
+			break;
+		default:
+			abort_with_usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1)
+		abort_with_usage(argv[0]);
+
+	try {
+		std::vector<uint16_t> rom = hackemu::load_rom(argv[optind]);
+		hackemu::computer computer(rom);
+		std::unique_ptr<hackemu::translation> translation;
+
+		for (const auto &poke : pokes)
+			computer.ram(poke.first) = poke.second;
+
+		auto translate_start = std::chrono::steady_clock::now();
+		if (translate)
+			translation.reset(new hackemu::translation(rom));
+		std::chrono::duration<double> translate_elapsed = std::chrono::steady_clock::now() - translate_start;
+
+		auto start = std::chrono::steady_clock::now();
+		hackemu::computer::status status;
+		if (translation)
+			status = computer.run_translated(*translation, max_cycles);
+		else if (naive)
+			status = computer.run_naive(max_cycles);
+		else
+			status = computer.run(max_cycles);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		if (status == hackemu::computer::status::halted)
+			std::cout << "Halted after " << computer.cycles() << " cycles" << std::endl;
+		else
+			std::cout << "Stopped after " << computer.cycles() << " cycles at pc "
+			          << computer.pc() << std::endl;
+
+		for (const auto &dump : dumps)
+			for (unsigned long address = dump.first; address <= dump.second; address++)
+				std::cout << "RAM[" << address << "] = "
+				          << static_cast<int16_t>(computer.ram(address)) << std::endl;
+
+		if (!screen_file.empty())
+			computer.write_screen(screen_file);
+
+		if (stats) {
+			if (translation)
+				std::cerr << "blocks:        " << translation->blocks() << std::endl
+				          << "translation:   " << translate_elapsed.count() << " s" << std::endl;
+			std::cerr << "cycles:        " << computer.cycles() << std::endl
+			          << "elapsed:       " << elapsed.count() << " s" << std::endl
+			          << "cycles/second: " << static_cast<uint64_t>(computer.cycles() / elapsed.count())
+			          << std::endl;
+		}
+
+		if (verify) {
+			hackemu::computer reference(rom);
+
+			for (const auto &poke : pokes)
+				reference.ram(poke.first) = poke.second;
+			reference.run_naive(computer.cycles());
+
+			bool same = reference.memory() == computer.memory() && reference.a() == computer.a() &&
+			            reference.d() == computer.d() && reference.pc() == computer.pc() &&
+			            reference.cycles() == computer.cycles();
+			for (std::size_t address = 0; address < hackemu::ram_size; address++)
+				if (reference.memory()[address] != computer.memory()[address])
+					std::cerr << "RAM[" << address << "] = " << computer.memory()[address]
+					          << ", expected " << reference.memory()[address] << std::endl;
+			if (!same) {
+				std::cerr << "Verification failed: A=" << computer.a() << " D=" << computer.d()
+				          << " PC=" << computer.pc() << " cycles=" << computer.cycles()
+				          << ", expected A=" << reference.a() << " D=" << reference.d()
+				          << " PC=" << reference.pc() << " cycles=" << reference.cycles() << std::endl;
+				return EXIT_FAILURE;
+			}
+			std::cout << "Verified against the naive interpreter" << std::endl;
+		}
+	} catch (const std::exception &e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return 0;
+}
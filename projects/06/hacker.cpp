@@ -2,71 +2,98 @@
  * Hacker is the Hack Assembler.
  *
  * To compile:
- * g++ hacker.cpp -std=c++11 -Wall -o hacker
+ * g++ hacker.cpp -std=c++17 -Wall -O2 -pthread -o hacker
+ *
+ * Usage:
+ * hacker [-b] [-s] [-j threads] file.asm
+ *   -b  write a packed little-endian binary ROM image (file.bin) instead
+ *       of the .hack text
+ *   -s  print statistics (source lines, parse and total time, lines per
+ *       second, symbol table lookups and inserts)
+ *   -j  assemble on that many threads (0 uses every core)
  */
 
 #include <cstdint>
-#include <map>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <vector>
+#include <string_view>
+#include <iterator>
 #include <iostream>
-#include <fstream>
-#include <iomanip>
 #include <algorithm>
-#include <bitset>
+#include <stdexcept>
+#include <chrono>
+#include <deque>
+#include <atomic>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hacker.h"
 
 namespace hacker {
 
-	class symbol_table {
+	/**
+	 * Read-only mapping of a whole source file.
+	 */
+	class source_file {
 	public:
-		void add_label(const std::string &symbol, uint16_t address)
+		source_file(const std::string &file)
 		{
-			m_symbol_table[symbol] = address;
+			int fd = ::open(file.c_str(), O_RDONLY);
+			if (fd < 0)
+				throw std::runtime_error("cannot open " + file);
+
+			struct stat st;
+			if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+				m_size = st.st_size;
+				void *map = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (map == MAP_FAILED) {
+					::close(fd);
+					throw std::runtime_error("cannot map " + file);
+				}
+				::madvise(map, m_size, MADV_SEQUENTIAL);
+				m_map = static_cast<const char *>(map);
+			}
+			::close(fd);
 		}
 
-		void add_var(const std::string &symbol)
+		~source_file()
 		{
-			m_symbol_table[symbol] = m_var_address++;
+			if (m_map)
+				::munmap(const_cast<char *>(m_map), m_size);
 		}
 
-		bool contains(const std::string &symbol)
+		source_file(const source_file &) = delete;
+		source_file &operator=(const source_file &) = delete;
+
+		const char *begin() const
 		{
-			return m_symbol_table.find(symbol) != m_symbol_table.end();
+			return m_map;
 		}
 
-		uint16_t address(const std::string &symbol)
+		const char *end() const
 		{
-			return m_symbol_table[symbol];
+			return m_map + m_size;
 		}
 
 	private:
-		std::map<std::string, uint16_t> m_symbol_table = {
-			{"0",      0x0000}, // workaround because stoi doesn't recognize 0
-			{"SP",     0x0000},
-			{"LCL",    0x0001},
-			{"ARG",    0x0002},
-			{"THIS",   0x0003},
-			{"THAT",   0x0004},
-			{"R0",     0x0000},
-			{"R1",     0x0001},
-			{"R2",     0x0002},
-			{"R3",     0x0003},
-			{"R4",     0x0004},
-			{"R5",     0x0005},
-			{"R6",     0x0006},
-			{"R7",     0x0007},
-			{"R8",     0x0008},
-			{"R9",     0x0009},
-			{"R10",    0x000A},
-			{"R11",    0x000B},
-			{"R12",    0x000C},
-			{"R13",    0x000D},
-			{"R14",    0x000E},
-			{"R15",    0x000F},
-			{"SCREEN", 0x4000},
-			{"KBD",    0x6000},
-		};
-		uint16_t m_var_address = 0x0010;
+		const char *m_map = nullptr;
+		std::size_t m_size = 0;
 	};
 
+	/**
+	 * The parser walks a range of a mapped source file and hands out
+	 * slices into it, so no memory is allocated per line. Only a line
+	 * that has whitespace in the middle of a command ("D = M") is copied
+	 * into a scratch buffer to squeeze the spaces out.
+	 */
 	class parser {
 	public:
 		enum class command_type {
@@ -76,72 +103,68 @@ namespace hacker {
 			l,
 		};
 
-		parser(const std::string &file)
-			: m_file(file, std::ifstream::in)
-		{
-		}
-
-		~parser()
+		parser(const char *begin, const char *end)
+			: m_pos(begin),
+			  m_end(end)
 		{
-			if (m_file.is_open())
-				m_file.close();
-		}
-
-		void reset()
-		{
-			m_command_type = command_type::none;
-			m_line_num = 0;
-			m_file.clear();
-			m_file.seekg(0);
 		}
 
 		bool has_more_commands() const
 		{
-			return m_file.good();
+			return m_pos < m_end;
 		}
 
 		void advance()
 		{
-			std::string line;
 			m_command_type = command_type::none;
-			do {
-				std::getline(m_file >> std::ws, line);
+			m_command = std::string_view();
+
+			while (m_pos < m_end && m_command_type == command_type::none) {
+				const char *begin = m_pos;
+				const char *end = static_cast<const char *>(std::memchr(m_pos, '\n', m_end - m_pos));
+				if (!end)
+					end = m_end;
+				m_pos = end < m_end ? end + 1 : m_end;
+				m_source_line++;
+
+				// remove comments from line
+				for (const char *c = begin; c + 1 < end; c++) {
+					if (c[0] == '/' && c[1] == '/') {
+						end = c;
+						break;
+					}
+				}
 
-				// remove all spaces
-				line.erase(std::remove_if(line.begin(),
-				                          line.end(),
-				                          [](char x){return std::isspace(x);}),
-				           line.end());
+				// trim spaces on both ends
+				while (begin < end && std::isspace(static_cast<unsigned char>(*begin)))
+					begin++;
+				while (end > begin && std::isspace(static_cast<unsigned char>(end[-1])))
+					end--;
 
-				if (line.empty())
+				if (begin == end)
 					continue;
 
-				// remove comments from string
-				std::string::size_type comment_pos = line.find("//");
+				m_command = std::string_view(begin, end - begin);
 
-				// check if line has comments
-				if (comment_pos != 0) {
+				// remove spaces in the middle of the command
+				if (std::any_of(begin, end, [](char x){return std::isspace(static_cast<unsigned char>(x));})) {
+					m_scratch.clear();
+					std::copy_if(begin, end, std::back_inserter(m_scratch),
+					             [](char x){return !std::isspace(static_cast<unsigned char>(x));});
+					m_command = m_scratch;
+				}
 
-					// remove comments if after command
-					if (comment_pos != std::string::npos)
-						line.erase(comment_pos);
+				if (m_command.front() == '@')
+					m_command_type = command_type::a;
+				else if (m_command.front() == '(' && m_command.back() == ')')
+					m_command_type = command_type::l;
+				else
+					m_command_type = command_type::c;
+			}
 
-					if (line.find("@") == 0)
-						m_command_type = command_type::a;
-					else if (line.find("(") == 0 &&
-					         line.rfind(")") == line.size() - 1)
-						m_command_type = command_type::l;
-					else
-						m_command_type = command_type::c;
-				}
-			} while (m_file.good() && m_command_type == command_type::none);
-
-			if (m_command_type != command_type::none) {
-				if (m_command_type != command_type::l)
-					m_line_num++;
-				m_command = line;
-			} else
-				m_command = "";
+			if (m_command_type != command_type::none &&
+			    m_command_type != command_type::l)
+				m_line_num++;
 		}
 
 		uint16_t line() const
@@ -149,12 +172,17 @@ namespace hacker {
 			return m_line_num;
 		}
 
+		std::size_t source_line() const
+		{
+			return m_source_line;
+		}
+
 		command_type command() const
 		{
 			return m_command_type;
 		}
 
-		std::string symbol() const
+		std::string_view symbol() const
 		{
 			switch (m_command_type) {
 			case command_type::a:
@@ -164,169 +192,328 @@ namespace hacker {
 				return m_command.substr(1, m_command.size() - 2);
 				break;
 			default:
-				return std::string("");
+				return std::string_view();
 			};
 		}
 
-		std::string dest() const
+		std::string_view dest() const
 		{
 			if (m_command_type != command_type::c)
-				return std::string("");
+				return std::string_view();
 
-			std::string::size_type find_len = m_command.find("=");
-			if (find_len == std::string::npos)
-				return std::string("");
+			std::string_view::size_type find_len = m_command.find('=');
+			if (find_len == std::string_view::npos)
+				return std::string_view();
 
 			return m_command.substr(0, find_len);
 		}
 
-		std::string comp() const
+		std::string_view comp() const
 		{
 			if (m_command_type != command_type::c)
-				return std::string("");
+				return std::string_view();
 
-			std::string::size_type find_len = m_command.find("=");
-			return m_command.substr(find_len + 1, m_command.find(";") - find_len - 1);
+			std::string_view::size_type find_len = m_command.find('=');
+			return m_command.substr(find_len + 1, m_command.find(';') - find_len - 1);
 		}
 
-		std::string jump() const
+		std::string_view jump() const
 		{
 			if (m_command_type != command_type::c)
-				return std::string("");
+				return std::string_view();
 
-			std::string::size_type find_len = m_command.find(";");
-			if (find_len == std::string::npos)
-				return std::string("");
+			std::string_view::size_type find_len = m_command.find(';');
+			if (find_len == std::string_view::npos)
+				return std::string_view();
 			return m_command.substr(find_len + 1);
 		}
 
 	private:
 		command_type m_command_type = command_type::none;
 		uint16_t m_line_num = 0;
-		std::ifstream m_file;
-		std::string m_command;
+		std::size_t m_source_line = 0;
+		const char *m_pos = nullptr;
+		const char *m_end = nullptr;
+		std::string_view m_command;
+		std::string m_scratch;
 	};
 
-	class code {
+	/**
+	 * Multi-threaded assembler. The source is split into chunks at line
+	 * boundaries, which are tokenized and encoded on a pool of threads
+	 * with symbolic operands left as references. A quick serial sweep
+	 * then defines all labels and resolves the references in source
+	 * order, so variables get the same addresses as in the single
+	 * threaded assembler. Finally the chunks are formatted in parallel
+	 * and written out in order.
+	 */
+	class parallel_assembler {
 	public:
-		code(const std::string &file, symbol_table *symbol_table)
-			: m_file(file, std::ofstream::out),
-			  m_symbol_table(symbol_table)
+		parallel_assembler(symbol_table *symbol_table, unsigned threads)
+			: m_symbol_table(symbol_table),
+			  m_threads(threads)
 		{
 		}
 
-		~code()
+		void parse(const source_file &source, const std::string &file_name)
 		{
-			if (m_file.is_open())
-				m_file.close();
+			split(source.begin(), source.end(), m_threads * 4);
+			run(m_chunks.size(), [this](std::size_t i) { parse_chunk(m_chunks[i]); });
+
+			std::size_t line = 0;
+			for (const chunk &c : m_chunks) {
+				if (!c.error.empty())
+					throw std::runtime_error(file_name + ":" + std::to_string(line + c.error_line) + ": " + c.error);
+				line += c.source_lines;
+			}
+			m_source_lines = line;
+
+			line = 0;
+			uint32_t base = 0;
+			for (const chunk &c : m_chunks) {
+				for (const label &l : c.labels) {
+					symbol_table::id id = m_symbol_table->intern(l.symbol);
+					if (m_symbol_table->defined(id))
+						throw std::runtime_error(file_name + ":" + std::to_string(line + l.line) +
+						                         ": symbol redefined: " + std::string(l.symbol));
+					m_symbol_table->add_label(id, static_cast<uint16_t>(base + l.address));
+				}
+				line += c.source_lines;
+				base += c.program.size();
+			}
+
+			for (chunk &c : m_chunks) {
+				for (const ref &r : c.refs) {
+					symbol_table::id id = m_symbol_table->intern(r.symbol);
+					if (!m_symbol_table->defined(id))
+						m_symbol_table->add_var(id);
+					c.program[r.index] = m_symbol_table->address(id);
+				}
+			}
 		}
 
-		void c_instruction(const std::string &dest, const std::string &comp, const std::string &jump)
+		void write(writer &w)
 		{
-			m_file << "111" << std::bitset<7>(m_comp[comp])
-			       << std::bitset<3>(m_dest[dest])
-			       << std::bitset<3>(m_jump[jump])
-			       << std::endl;
+			writer::format format = w.output_format();
+			std::size_t width = writer::width(format);
+
+			run(m_chunks.size(), [&](std::size_t i) {
+				chunk &c = m_chunks[i];
+				c.output.resize(c.program.size() * width);
+				for (std::size_t j = 0; j < c.program.size(); j++)
+					writer::encode(format, c.program[j], c.output.data() + j * width);
+			});
+
+			for (const chunk &c : m_chunks)
+				w.write(c.output.data(), c.output.size());
 		}
 
-		void a_instruction(const std::string &symbol)
+		std::size_t source_lines() const
 		{
-			uint16_t address;
-			try {
-				if ((address = std::stoi(symbol)));
-			} catch(std::invalid_argument) {
-				if (!m_symbol_table->contains(symbol))
-					m_symbol_table->add_var(symbol);
-
-				address = m_symbol_table->address(symbol);
-			}
-			m_file << std::setfill('0') << std::setw(16) << std::bitset<16>(address) << std::endl;
+			return m_source_lines;
 		}
 
 	private:
-		std::ofstream m_file;
-		symbol_table *m_symbol_table;
-
-		std::map<std::string, uint16_t> m_dest = {
-			{"",    0b000},
-			{"M",   0b001},
-			{"D",   0b010},
-			{"MD",  0b011},
-			{"A",   0b100},
-			{"AM",  0b101},
-			{"AD",  0b110},
-			{"AMD", 0b111},
+		struct label {
+			uint32_t address;
+			std::size_t line;
+			std::string_view symbol;
 		};
-		std::map<std::string, uint16_t> m_comp = {
-			{"0",   0b0101010},
-			{"1",   0b0111111},
-			{"-1",  0b0111010},
-			{"D",   0b0001100},
-			{"A",   0b0110000},
-			{"!D",  0b0001101},
-			{"!A",  0b0110001},
-			{"-D",  0b0001111},
-			{"-A",  0b0110011},
-			{"D+1", 0b0011111},
-			{"A+1", 0b0110111},
-			{"D-1", 0b0001110},
-			{"A-1", 0b0110010},
-			{"D+A", 0b0000010},
-			{"D-A", 0b0010011},
-			{"A-D", 0b0000111},
-			{"D&A", 0b0000000},
-			{"D|A", 0b0010101},
-			{"M",   0b1110000},
-			{"!M",  0b1110001},
-			{"-M",  0b1110011},
-			{"M+1", 0b1110111},
-			{"M-1", 0b1110010},
-			{"D+M", 0b1000010},
-			{"D-M", 0b1010011},
-			{"M-D", 0b1000111},
-			{"D&M", 0b1000000},
-			{"D|M", 0b1010101},
+
+		struct ref {
+			uint32_t index;
+			std::string_view symbol;
 		};
-		std::map<std::string, uint16_t> m_jump = {
-			{"",    0b000},
-			{"JGT", 0b001},
-			{"JEQ", 0b010},
-			{"JGE", 0b011},
-			{"JLT", 0b100},
-			{"JNE", 0b101},
-			{"JLE", 0b110},
-			{"JMP", 0b111},
+
+		struct chunk {
+			const char *begin;
+			const char *end;
+			std::vector<uint16_t> program;
+			std::vector<label> labels;
+			std::vector<ref> refs;
+			std::deque<std::string> copies; // commands squeezed by the parser
+			std::size_t source_lines = 0;
+			std::string error;
+			std::size_t error_line = 0;
+			std::vector<char> output;
 		};
+
+		void split(const char *begin, const char *end, std::size_t count)
+		{
+			std::size_t size = (end - begin) / count + 1;
+			while (begin < end) {
+				const char *split = begin + std::min<std::size_t>(size, end - begin);
+				split = static_cast<const char *>(std::memchr(split - 1, '\n', end - split + 1));
+				split = split ? split + 1 : end;
+
+				m_chunks.emplace_back();
+				m_chunks.back().begin = begin;
+				m_chunks.back().end = split;
+				begin = split;
+			}
+		}
+
+		static std::string_view keep(chunk &c, std::string_view symbol)
+		{
+			if (symbol.data() >= c.begin && symbol.data() < c.end)
+				return symbol;
+
+			c.copies.emplace_back(symbol);
+			return c.copies.back();
+		}
+
+		static void parse_chunk(chunk &c)
+		{
+			parser p(c.begin, c.end);
+			code encoder;
+
+			try {
+				while (p.has_more_commands()) {
+					p.advance();
+					if (p.command() == parser::command_type::l) {
+						c.labels.push_back({static_cast<uint32_t>(c.program.size()), p.source_line(),
+						                    keep(c, p.symbol())});
+					} else if (p.command() == parser::command_type::a) {
+						uint16_t value = 0;
+						if (!assembler::constant(p.symbol(), &value))
+							c.refs.push_back({static_cast<uint32_t>(c.program.size()), keep(c, p.symbol())});
+						c.program.push_back(value);
+					} else if (p.command() == parser::command_type::c) {
+						c.program.push_back(encoder.c_instruction(p.dest(), p.comp(), p.jump()));
+					}
+				}
+			} catch (const std::exception &e) {
+				c.error = e.what();
+				c.error_line = p.source_line();
+			}
+			c.source_lines = p.source_line();
+		}
+
+		// Runs work(0) .. work(items - 1) on the thread pool.
+		template<typename F>
+		void run(std::size_t items, F work)
+		{
+			std::atomic<std::size_t> next(0);
+			auto worker = [&]() {
+				for (std::size_t i; (i = next++) < items; )
+					work(i);
+			};
+
+			std::vector<std::thread> pool;
+			for (unsigned t = 1; t < m_threads; t++)
+				pool.emplace_back(worker);
+			worker();
+			for (std::thread &t : pool)
+				t.join();
+		}
+
+		symbol_table *m_symbol_table;
+		unsigned m_threads;
+		std::vector<chunk> m_chunks;
+		std::size_t m_source_lines = 0;
 	};
 
 } // namespace hacker
 
+static void abort_with_usage(const char *argv0)
+{
+	std::cerr << "usage: " << argv0 << " [-b] [-s] [-j threads] file.asm" << std::endl;
+	std::abort();
+}
+
 int main(int argc, char *argv[])
 {
-	hacker::symbol_table symbol_table;
-	std::string file_name(argv[1]);
-	std::string hack_file_name(file_name.substr(0, file_name.rfind(".")).append(".hack"));
+	hacker::writer::format format = hacker::writer::format::hack;
+	bool stats = false;
+	unsigned threads = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bsj:")) != -1) {
+		switch (opt) {
+		case 'b':
+			format = hacker::writer::format::binary;
+			break;
+		case 's':
+			stats = true;
+			break;
+		case 'j':
+			threads = std::strtoul(optarg, nullptr, 10);
+			if (threads == 0)
+				threads = std::max(std::thread::hardware_concurrency(), 1u);
+			break;
+		default:
+			abort_with_usage(argv[0]);
+		}
+	}
 
-	hacker::parser p(file_name);
-	hacker::code c(hack_file_name, &symbol_table);
+	if (optind != argc - 1)
+		abort_with_usage(argv[0]);
 
-	while (p.has_more_commands()) {
-		p.advance();
-		if (p.command() == hacker::parser::command_type::l)
-			symbol_table.add_label(p.symbol(), p.line());
-	}
+	hacker::symbol_table symbol_table;
+	std::string file_name(argv[optind]);
+	std::string hack_file_name(file_name.substr(0, file_name.rfind("."))
+	                           .append(format == hacker::writer::format::hack ? ".hack" : ".bin"));
+	auto start = std::chrono::steady_clock::now();
+	std::chrono::duration<double> parse_elapsed;
+	std::size_t source_lines;
+
+	try {
+		hacker::source_file source(file_name);
+		hacker::writer w(hack_file_name, format);
+
+		if (threads > 1) {
+			hacker::parallel_assembler a(&symbol_table, threads);
+
+			a.parse(source, file_name);
+			parse_elapsed = std::chrono::steady_clock::now() - start;
+
+			a.write(w);
+			source_lines = a.source_lines();
+		} else {
+			hacker::parser p(source.begin(), source.end());
+			hacker::code c;
+			hacker::assembler a(&symbol_table);
 
-	p.reset();
+			try {
+				while (p.has_more_commands()) {
+					p.advance();
+					if (p.command() == hacker::parser::command_type::l)
+						a.label(p.symbol());
+					else if (p.command() == hacker::parser::command_type::a)
+						a.a_instruction(p.symbol());
+					else if (p.command() == hacker::parser::command_type::c)
+						a.c_instruction(c.c_instruction(p.dest(), p.comp(), p.jump()));
+				}
+			} catch (const std::exception &e) {
+				throw std::runtime_error(file_name + ":" + std::to_string(p.source_line()) + ": " + e.what());
+			}
+			parse_elapsed = std::chrono::steady_clock::now() - start;
 
-	while (p.has_more_commands()) {
-		p.advance();
-		if (p.command() == hacker::parser::command_type::a)
-			c.a_instruction(p.symbol());
-		else if (p.command() == hacker::parser::command_type::c)
-			c.c_instruction(p.dest(), p.comp(), p.jump());
+			for (uint16_t instruction : a.program())
+				w.write(instruction);
+			source_lines = p.source_line();
+		}
+		w.flush();
+	} catch (const std::exception &e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
 	}
 
 	std::cout << "Writen binary to: " << hack_file_name << std::endl;
 
+	if (stats) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cerr << "lines:         " << source_lines << std::endl
+		          << "parse time:    " << parse_elapsed.count() << " s ("
+		          << static_cast<uint64_t>(source_lines / parse_elapsed.count()) << " lines/s)" << std::endl
+		          << "total time:    " << elapsed.count() << " s ("
+		          << static_cast<uint64_t>(source_lines / elapsed.count()) << " lines/s)" << std::endl
+		          << "symbols:       " << symbol_table.size() << std::endl
+		          << "lookups:       " << symbol_table.stats().lookups << std::endl
+		          << "inserts:       " << symbol_table.stats().inserts << std::endl
+		          << "probes/lookup: " << static_cast<double>(symbol_table.stats().probes) /
+		                                  std::max<uint64_t>(symbol_table.stats().lookups, 1) << std::endl;
+	}
+
 	return 0;
 }
@@ -0,0 +1,550 @@
+#pragma once
+
+/**
+ * Assembler backend of hacker: the symbol table, instruction encoding, the
+ * single pass assembler and the .hack/.bin writer. Anything that produces
+ * Hack instructions in memory can feed them to hacker::assembler without
+ * going through assembly text.
+ */
+
+#include <cstdint>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace hacker {
+
+	/**
+	 * Open addressing hash table (linear probing) of interned symbols.
+	 * Every symbol gets a small integer id on first sight, and callers
+	 * work with ids from then on, so a symbolic A-instruction costs a
+	 * single find-or-insert. Names live back to back in one pool.
+	 */
+	class symbol_table {
+	public:
+		using id = uint32_t;
+
+		enum class kind : uint8_t {
+			undefined,
+			predefined,
+			label,
+			var,
+		};
+
+		struct counters {
+			uint64_t lookups = 0;
+			uint64_t inserts = 0;
+			uint64_t probes = 0;
+		};
+
+		symbol_table()
+			: m_slots(64, 0)
+		{
+			static const struct {
+				const char *symbol;
+				uint16_t address;
+			} predefined[] = {
+				{"SP",     0x0000},
+				{"LCL",    0x0001},
+				{"ARG",    0x0002},
+				{"THIS",   0x0003},
+				{"THAT",   0x0004},
+				{"R0",     0x0000},
+				{"R1",     0x0001},
+				{"R2",     0x0002},
+				{"R3",     0x0003},
+				{"R4",     0x0004},
+				{"R5",     0x0005},
+				{"R6",     0x0006},
+				{"R7",     0x0007},
+				{"R8",     0x0008},
+				{"R9",     0x0009},
+				{"R10",    0x000A},
+				{"R11",    0x000B},
+				{"R12",    0x000C},
+				{"R13",    0x000D},
+				{"R14",    0x000E},
+				{"R15",    0x000F},
+				{"SCREEN", 0x4000},
+				{"KBD",    0x6000},
+			};
+
+			for (const auto &p : predefined)
+				define(intern(p.symbol), kind::predefined, p.address);
+			m_counters = counters();
+		}
+
+		// Returns the id of symbol, adding it as undefined if it is new.
+		id intern(std::string_view symbol)
+		{
+			uint32_t hash = fnv1a(symbol);
+			std::size_t mask = m_slots.size() - 1;
+
+			m_counters.lookups++;
+			for (std::size_t i = hash & mask; ; i = (i + 1) & mask) {
+				m_counters.probes++;
+				uint32_t slot = m_slots[i];
+				if (slot == 0)
+					break;
+
+				const entry &e = m_entries[slot - 1];
+				if (e.hash == hash && name(slot - 1) == symbol)
+					return slot - 1;
+			}
+
+			m_counters.inserts++;
+			id symbol_id = m_entries.size();
+			m_entries.push_back({hash, static_cast<uint32_t>(m_names.size()),
+			                     static_cast<uint32_t>(symbol.size()), 0, kind::undefined});
+			m_names.append(symbol);
+
+			if (2 * m_entries.size() > m_slots.size())
+				grow();
+			else
+				insert_slot(symbol_id);
+
+			return symbol_id;
+		}
+
+		std::string_view name(id symbol) const
+		{
+			const entry &e = m_entries[symbol];
+			return std::string_view(m_names).substr(e.offset, e.length);
+		}
+
+		kind type(id symbol) const
+		{
+			return m_entries[symbol].kind;
+		}
+
+		bool defined(id symbol) const
+		{
+			return m_entries[symbol].kind != kind::undefined;
+		}
+
+		uint16_t address(id symbol) const
+		{
+			return m_entries[symbol].address;
+		}
+
+		void add_label(id symbol, uint16_t address)
+		{
+			define(symbol, kind::label, address);
+		}
+
+		void add_var(id symbol)
+		{
+			define(symbol, kind::var, m_var_address++);
+		}
+
+		std::size_t size() const
+		{
+			return m_entries.size();
+		}
+
+		const counters &stats() const
+		{
+			return m_counters;
+		}
+
+	private:
+		struct entry {
+			uint32_t hash;
+			uint32_t offset;
+			uint32_t length;
+			uint16_t address;
+			symbol_table::kind kind;
+		};
+
+		static uint32_t fnv1a(std::string_view symbol)
+		{
+			uint32_t hash = 2166136261u;
+			for (char c : symbol) {
+				hash ^= static_cast<unsigned char>(c);
+				hash *= 16777619u;
+			}
+			return hash;
+		}
+
+		void define(id symbol, kind kind, uint16_t address)
+		{
+			m_entries[symbol].kind = kind;
+			m_entries[symbol].address = address;
+		}
+
+		void insert_slot(id symbol)
+		{
+			std::size_t mask = m_slots.size() - 1;
+			std::size_t i = m_entries[symbol].hash & mask;
+			while (m_slots[i] != 0)
+				i = (i + 1) & mask;
+			m_slots[i] = symbol + 1;
+		}
+
+		void grow()
+		{
+			m_slots.assign(m_slots.size() * 2, 0);
+			for (id symbol = 0; symbol < m_entries.size(); symbol++)
+				insert_slot(symbol);
+		}
+
+		std::vector<entry> m_entries;
+		std::vector<uint32_t> m_slots; // id + 1, 0 is an empty slot
+		std::string m_names;
+		uint16_t m_var_address = 0x0010;
+		counters m_counters;
+	};
+
+	/**
+	 * Packs a mnemonic of up to three characters into an integer, so the
+	 * encoding tables below can be plain switches the compiler turns into
+	 * jump tables or binary searches. Longer mnemonics never match.
+	 */
+	constexpr uint32_t mnemonic(std::string_view m)
+	{
+		if (m.size() > 3)
+			return UINT32_MAX;
+
+		uint32_t key = 0;
+		for (std::size_t i = 0; i < m.size(); i++)
+			key |= static_cast<uint32_t>(static_cast<unsigned char>(m[i])) << (8 * i);
+		return key;
+	}
+
+	constexpr int dest_bits(std::string_view dest)
+	{
+		switch (mnemonic(dest)) {
+		case mnemonic(""):    return 0b000;
+		case mnemonic("M"):   return 0b001;
+		case mnemonic("D"):   return 0b010;
+		case mnemonic("MD"):  return 0b011;
+		case mnemonic("A"):   return 0b100;
+		case mnemonic("AM"):  return 0b101;
+		case mnemonic("AD"):  return 0b110;
+		case mnemonic("AMD"): return 0b111;
+		default:              return -1;
+		}
+	}
+
+	constexpr int comp_bits(std::string_view comp)
+	{
+		switch (mnemonic(comp)) {
+		case mnemonic("0"):   return 0b0101010;
+		case mnemonic("1"):   return 0b0111111;
+		case mnemonic("-1"):  return 0b0111010;
+		case mnemonic("D"):   return 0b0001100;
+		case mnemonic("A"):   return 0b0110000;
+		case mnemonic("!D"):  return 0b0001101;
+		case mnemonic("!A"):  return 0b0110001;
+		case mnemonic("-D"):  return 0b0001111;
+		case mnemonic("-A"):  return 0b0110011;
+		case mnemonic("D+1"): return 0b0011111;
+		case mnemonic("A+1"): return 0b0110111;
+		case mnemonic("D-1"): return 0b0001110;
+		case mnemonic("A-1"): return 0b0110010;
+		case mnemonic("D+A"): return 0b0000010;
+		case mnemonic("D-A"): return 0b0010011;
+		case mnemonic("A-D"): return 0b0000111;
+		case mnemonic("D&A"): return 0b0000000;
+		case mnemonic("D|A"): return 0b0010101;
+		case mnemonic("M"):   return 0b1110000;
+		case mnemonic("!M"):  return 0b1110001;
+		case mnemonic("-M"):  return 0b1110011;
+		case mnemonic("M+1"): return 0b1110111;
+		case mnemonic("M-1"): return 0b1110010;
+		case mnemonic("D+M"): return 0b1000010;
+		case mnemonic("D-M"): return 0b1010011;
+		case mnemonic("M-D"): return 0b1000111;
+		case mnemonic("D&M"): return 0b1000000;
+		case mnemonic("D|M"): return 0b1010101;
+		default:              return -1;
+		}
+	}
+
+	constexpr int jump_bits(std::string_view jump)
+	{
+		switch (mnemonic(jump)) {
+		case mnemonic(""):    return 0b000;
+		case mnemonic("JGT"): return 0b001;
+		case mnemonic("JEQ"): return 0b010;
+		case mnemonic("JGE"): return 0b011;
+		case mnemonic("JLT"): return 0b100;
+		case mnemonic("JNE"): return 0b101;
+		case mnemonic("JLE"): return 0b110;
+		case mnemonic("JMP"): return 0b111;
+		default:              return -1;
+		}
+	}
+
+	class code {
+	public:
+		uint16_t c_instruction(std::string_view dest, std::string_view comp, std::string_view jump) const
+		{
+			int d = dest_bits(dest);
+			int c = comp_bits(comp);
+			int j = jump_bits(jump);
+
+			if (d < 0)
+				throw std::runtime_error("unknown dest mnemonic: " + std::string(dest));
+			if (c < 0)
+				throw std::runtime_error("unknown comp mnemonic: " + std::string(comp));
+			if (j < 0)
+				throw std::runtime_error("unknown jump mnemonic: " + std::string(jump));
+
+			return 0xE000 | c << 6 | d << 3 | j;
+		}
+	};
+
+	/**
+	 * ASCII digits of every byte value, most significant bit first, so
+	 * a 16-bit word is formatted with two 8-byte copies.
+	 */
+	struct byte_bits {
+		char bits[256][8];
+
+		constexpr byte_bits() : bits()
+		{
+			for (int b = 0; b < 256; b++)
+				for (int i = 0; i < 8; i++)
+					bits[b][i] = (b >> (7 - i)) & 1 ? '1' : '0';
+		}
+	};
+
+	/**
+	 * Output stage. Instructions are formatted into a large reusable
+	 * buffer which is written out in big blocks, either as the .hack
+	 * text (one line of 16 ASCII digits per word) or as a packed
+	 * little-endian uint16_t ROM image.
+	 */
+	class writer {
+	public:
+		enum class format {
+			hack,
+			binary,
+		};
+
+		writer(const std::string &file, format format)
+			: m_format(format),
+			  m_buffer(1 << 20)
+		{
+			m_fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (m_fd < 0)
+				throw std::runtime_error("cannot create " + file);
+		}
+
+		~writer()
+		{
+			if (m_fd >= 0)
+				::close(m_fd);
+		}
+
+		writer(const writer &) = delete;
+		writer &operator=(const writer &) = delete;
+
+		// Bytes taken by one instruction in the given format.
+		static std::size_t width(format format)
+		{
+			return format == format::hack ? 17 : 2;
+		}
+
+		static void encode(format format, uint16_t instruction, char *out)
+		{
+			static constexpr byte_bits table;
+
+			switch (format) {
+			case format::hack:
+				std::memcpy(out, table.bits[instruction >> 8], 8);
+				std::memcpy(out + 8, table.bits[instruction & 0xFF], 8);
+				out[16] = '\n';
+				break;
+			case format::binary:
+				out[0] = instruction & 0xFF;
+				out[1] = instruction >> 8;
+				break;
+			}
+		}
+
+		void write(uint16_t instruction)
+		{
+			if (m_used + width(m_format) > m_buffer.size())
+				flush();
+
+			encode(m_format, instruction, m_buffer.data() + m_used);
+			m_used += width(m_format);
+		}
+
+		// Writes already encoded instructions.
+		void write(const char *data, std::size_t size)
+		{
+			flush();
+			write_all(data, size);
+		}
+
+		void flush()
+		{
+			write_all(m_buffer.data(), m_used);
+			m_used = 0;
+		}
+
+		format output_format() const
+		{
+			return m_format;
+		}
+
+	private:
+		void write_all(const char *data, std::size_t size)
+		{
+			while (size > 0) {
+				ssize_t n = ::write(m_fd, data, size);
+				if (n < 0) {
+					if (errno == EINTR)
+						continue;
+					throw std::runtime_error(std::string("write failed: ") + std::strerror(errno));
+				}
+				data += n;
+				size -= n;
+			}
+		}
+
+		format m_format;
+		int m_fd;
+		std::vector<char> m_buffer;
+		std::size_t m_used = 0;
+	};
+
+	/**
+	 * Single pass assembler. Every line is parsed only once into an
+	 * in-memory program. A-instructions referring to symbols that are
+	 * not known yet are recorded as forward references and backpatched
+	 * when the label is defined. Whatever is still unresolved at the end
+	 * is a variable, allocated in order of first use.
+	 */
+	class assembler {
+	public:
+		assembler(symbol_table *symbol_table)
+			: m_symbol_table(symbol_table)
+		{
+		}
+
+		void label(std::string_view symbol)
+		{
+			symbol_table::id id = m_symbol_table->intern(symbol);
+			if (m_symbol_table->defined(id))
+				throw std::runtime_error("symbol redefined: " + std::string(symbol));
+
+			uint16_t address = m_program.size();
+			m_symbol_table->add_label(id, address);
+			patch(id, address);
+		}
+
+		void a_instruction(std::string_view symbol)
+		{
+			uint16_t value;
+			if (constant(symbol, &value)) {
+				m_program.push_back(value);
+				return;
+			}
+
+			symbol_table::id id = m_symbol_table->intern(symbol);
+			if (!m_symbol_table->defined(id)) {
+				forward(id);
+				m_program.push_back(0);
+				return;
+			}
+
+			m_program.push_back(m_symbol_table->address(id));
+		}
+
+		void c_instruction(uint16_t instruction)
+		{
+			m_program.push_back(instruction);
+		}
+
+		const std::vector<uint16_t> &program()
+		{
+			for (symbol_table::id id : m_forward_order) {
+				if (m_symbol_table->defined(id))
+					continue;
+
+				m_symbol_table->add_var(id);
+				patch(id, m_symbol_table->address(id));
+			}
+			m_forward_order.clear();
+
+			return m_program;
+		}
+
+		/**
+		 * Converts an A-instruction operand if it is a constant. Symbols
+		 * cannot begin with a digit, so anything that does must be a
+		 * decimal in the range 0-32767.
+		 */
+		static bool constant(std::string_view symbol, uint16_t *value)
+		{
+			if (symbol.empty())
+				throw std::runtime_error("missing A-instruction operand");
+
+			if (!std::isdigit(static_cast<unsigned char>(symbol.front())) && symbol.front() != '-')
+				return false;
+
+			uint32_t v = 0;
+			for (char c : symbol) {
+				if (c < '0' || c > '9')
+					throw std::runtime_error("invalid constant: " + std::string(symbol));
+
+				v = v * 10 + (c - '0');
+				if (v > max_constant)
+					throw std::runtime_error("constant out of range (0-32767): " + std::string(symbol));
+			}
+			*value = v;
+			return true;
+		}
+
+	private:
+		static constexpr uint32_t none = UINT32_MAX;
+		static constexpr uint32_t max_constant = 0x7FFF;
+
+		// Forward references of a symbol are chained through m_refs,
+		// m_forward[id] holds the most recent one.
+		struct ref {
+			uint32_t index;
+			uint32_t next;
+		};
+
+		void forward(symbol_table::id id)
+		{
+			if (id >= m_forward.size())
+				m_forward.resize(m_symbol_table->size(), none);
+
+			if (m_forward[id] == none)
+				m_forward_order.push_back(id);
+
+			m_refs.push_back({static_cast<uint32_t>(m_program.size()), m_forward[id]});
+			m_forward[id] = m_refs.size() - 1;
+		}
+
+		void patch(symbol_table::id id, uint16_t address)
+		{
+			if (id >= m_forward.size())
+				return;
+
+			for (uint32_t r = m_forward[id]; r != none; r = m_refs[r].next)
+				m_program[m_refs[r].index] = address;
+		}
+
+		symbol_table *m_symbol_table;
+		std::vector<uint16_t> m_program;
+		std::vector<uint32_t> m_forward;
+		std::vector<ref> m_refs;
+		std::vector<symbol_table::id> m_forward_order;
+	};
+
+} // namespace hacker
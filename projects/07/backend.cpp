@@ -0,0 +1,61 @@
+#include "backend.h"
+
+#include <string_view>
+
+using namespace vm;
+
+backend::backend()
+	: m_assembler(&m_symbol_table),
+	  m_size(0)
+{
+}
+
+void backend::assemble(std::string_view text)
+{
+	for (std::string_view::size_type begin = 0, end; begin < text.size(); begin = end + 1) {
+		end = text.find('\n', begin);
+		if (end == std::string_view::npos)
+			end = text.size();
+
+		std::string_view i(text.substr(begin, end - begin));
+
+		try {
+			if (i.front() == '(') {
+				m_assembler.label(i.substr(1, i.size() - 2));
+				continue;
+			}
+
+			m_size++;
+
+			if (i.front() == '@') {
+				m_assembler.a_instruction(i.substr(1));
+				continue;
+			}
+
+			std::string_view::size_type equal = i.find('=');
+			std::string_view::size_type semicolon = i.find(';');
+			std::string_view::size_type comp = equal == std::string_view::npos ? 0 : equal + 1;
+
+			m_assembler.c_instruction(m_code.c_instruction(
+				equal == std::string_view::npos ? std::string_view() : i.substr(0, equal),
+				i.substr(comp, semicolon == std::string_view::npos ? std::string_view::npos : semicolon - comp),
+				semicolon == std::string_view::npos ? std::string_view() : i.substr(semicolon + 1)));
+		} catch (const std::exception &e) {
+			throw std::runtime_error(std::string(i) + ": " + e.what());
+		}
+	}
+}
+
+std::size_t backend::size() const
+{
+	return m_size;
+}
+
+void backend::write(const std::string &file, hacker::writer::format format)
+{
+	hacker::writer w(file, format);
+
+	for (uint16_t instruction : m_assembler.program())
+		w.write(instruction);
+	w.flush();
+}
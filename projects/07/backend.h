@@ -0,0 +1,35 @@
+#pragma once
+
+#include "hacker.h"
+
+#include <string>
+#include <string_view>
+
+namespace vm {
+	/**
+	 * In-process assembler backend. The translator hands over its
+	 * text as it comes out of the peephole pass, one label or instruction
+	 * per line without blanks or comments, so the lines go
+	 * straight into hacker::assembler: a label or A-instruction is the
+	 * symbol after its first character, a C-instruction is split into its
+	 * dest, comp and jump fields at '=' and ';'. No assembly text is
+	 * written or tokenized again.
+	 */
+	class backend {
+	public:
+		backend();
+
+		void assemble(std::string_view text);
+
+		// Instructions assembled so far.
+		std::size_t size() const;
+
+		void write(const std::string &file, hacker::writer::format format);
+
+	private:
+		hacker::symbol_table m_symbol_table;
+		hacker::assembler m_assembler;
+		hacker::code m_code;
+		std::size_t m_size;
+	};
+} // namespace vm
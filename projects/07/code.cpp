@@ -1,10 +1,10 @@
 #include "code.h"
 #include "command_type.h"
+#include "peephole.h"
 
-#include <sstream>
-#include <map>
 #include <cctype>
 #include <algorithm>
+#include <string_view>
 
 #include <boost/assert.hpp>
 #include <boost/filesystem.hpp>
@@ -13,47 +13,154 @@ namespace fs = boost::filesystem;
 
 using namespace vm;
 
+namespace {
+	// Decimal digits of an integer, formatted without allocating.
+	class decimal {
+	public:
+		explicit decimal(std::size_t value)
+			: m_begin(sizeof(m_digits))
+		{
+			do {
+				m_digits[--m_begin] = '0' + value % 10;
+				value /= 10;
+			} while (value);
+		}
+
+		operator std::string_view() const
+		{
+			return std::string_view(m_digits + m_begin, sizeof(m_digits) - m_begin);
+		}
+
+	private:
+		char m_digits[20];
+		std::size_t m_begin;
+	};
+
+	// Static variables are named after the file they belong to.
+	std::string static_name(const std::string &stem)
+	{
+		std::string name = "STATIC" + stem;
+		name.erase(std::remove_if(name.begin(), name.end(), ::isspace), name.end());
+		return name;
+	}
+
+	const std::string_view registers[] = {
+		"R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7",
+		"R8", "R9", "R10", "R11", "R12", "R13", "R14", "R15",
+	};
+} // namespace
+
 class code_p {
 public:
-	code_p(std::ostream &ostream);
+	code_p(std::ostream *ostream, const code::options &opts);
 
 	void set_static_label(const std::string &label);
-	void eval_push_pop(vm::command_type cmd, const std::string &segment, uint16_t index);
-	void eval_arithmetic(const std::string &cmd);
-
-	// write assembly
-	void w(const std::string &command);
+	void eval_push_pop(vm::command_type cmd, vm::segment segment, uint16_t index, std::string_view file);
+	void eval_arithmetic(vm::arithmetic_op op);
+	void eval_function(std::string_view name, uint16_t locals);
+	void eval_call(std::string_view name, uint16_t arguments);
+	void eval_return();
+	void eval_init();
+
+	// Prefix of the labels of the current function.
+	const std::string &label_scope() const;
+
+	// -O2 keeps pushed values as operands until a command needs them on
+	// the stack; these return false when the command is to be written as is.
+	bool defer_push(vm::segment segment, uint16_t index, std::string_view file);
+	bool defer_pop(vm::segment segment, uint16_t index, std::string_view file);
+	bool defer_arithmetic(vm::arithmetic_op op);
+	template<typename... T>
+	bool defer_if(const T &... label);
+	void spill();
+
+	// write assembly, one line from its parts
+	template<typename... T>
+	void w(const T &... parts);
+	void flush();
+	std::string release();
 
 	// helper functions
 	void sp_inc();
 	void sp_dec();
-	void comp_to_stack(const std::string &comp);
-	void stack_to_dest(const std::string &dest);
-	void seg_to_desc(const std::string &dest, const std::string &label, uint16_t index);
-	void load_seg(const std::string &label, uint16_t index);
+	void comp_to_stack(std::string_view comp);
+	void stack_to_dest(std::string_view dest);
+	void seg_to_desc(std::string_view dest, std::string_view label, uint16_t index);
+	void load_seg(std::string_view label, uint16_t index);
 	void load_constant(uint16_t constant);
-	void comp_to_reg(const std::string &comp, const std::string &reg);
-	void reg_to_dest(const std::string &dest, const std::string &reg);
+	void comp_to_reg(std::string_view comp, std::string_view reg);
+	void reg_to_dest(std::string_view dest, std::string_view reg);
 
-	std::string label_create();
-	template<typename T>
-	void label_add(const T &label);
-	template<typename T>
-	void label_at(const T &label);
-	void label_jump_with_comp(const std::string &comp, const std::string &jmp, const std::string &label);
+	// Generated label, the file's label prefix and a serial number.
+	struct label {
+		std::size_t number;
+	};
+
+	label label_create();
+	template<typename... T>
+	void label_add(const T &... parts);
+	void label_add(label label);
+	template<typename... T>
+	void label_at(const T &... parts);
+	void label_at(label label);
+	void label_at(uint16_t constant);
+	template<typename... T>
+	void label_jump_with_comp(std::string_view comp, std::string_view jmp, const T &... label);
+
+	void call_routine(code::routine routine, label label);
+	void write_routines(unsigned routines);
+	void write_call_routine();
+	void write_return_routine();
+
+	const vm::peephole &peephole() const;
+	unsigned routines() const;
 
 private:
 	using command_function = void(code_p::*)(vm::command_type, uint16_t);
 	using arithmetic_function = void(code_p::*)();
 
-	std::ostream &m_ostream;
-	std::map<std::string, command_function> m_push_pop_function;
-	std::map<std::string, arithmetic_function> m_arithmetic_function;
+	// Indexed by vm::segment and vm::arithmetic_op.
+	static const command_function s_push_pop_function[static_cast<std::size_t>(vm::segment::count)];
+	static const arithmetic_function s_arithmetic_function[static_cast<std::size_t>(vm::arithmetic_op::count)];
+
+	std::ostream *m_ostream;
+	vm::peephole m_peephole;
 	std::size_t m_label_count;
 	std::string m_label_static_name;
+	std::string m_label_prefix;
+	std::string m_static_label;
+	std::string_view m_static_file;
+	std::string m_label_scope;
+	bool m_shared_comparisons;
+	bool m_shared_calls;
+	unsigned m_routines;
+
+	/**
+	 * A pushed value not written to the stack yet: a constant, a segment
+	 * variable, or an operation on earlier operands. Operands are only
+	 * evaluated into D when they are stored, branched on or spilled.
+	 */
+	struct operand {
+		enum class kind { constant, variable, operation } kind;
+		vm::segment segment;
+		// Value of a constant, index of a variable.
+		uint16_t index;
+		std::string_view file;
+		vm::arithmetic_op op;
+		// Operands of op; a unary op only has a right one.
+		std::size_t left, right;
+	};
+
+	// The most values kept off the stack, as many as R5-R12.
+	static const std::size_t s_max_deferred = 8;
+
+	bool m_defer;
+	std::vector<operand> m_operands;
+	// Operands on the virtual stack, bottom first.
+	std::vector<std::size_t> m_deferred;
 
-	void push_pop_seg(const std::string &seg, vm::command_type cmd, uint16_t index);
-	void push_pop_reg(const std::string &reg, command_type cmd, uint16_t index);
+	void push_pop_seg(std::string_view seg, vm::command_type cmd, uint16_t index);
+	void push_pop_reg(std::string_view reg, command_type cmd, uint16_t index);
 	void push_pop_constant(vm::command_type cmd, uint16_t index);
 	void push_pop_local(vm::command_type cmd, uint16_t index);
 	void push_pop_argument(vm::command_type cmd, uint16_t index);
@@ -72,10 +179,29 @@ private:
 	void arithmetic_and();
 	void arithmetic_or();
 	void arithmetic_not();
+
+	void call_inline(std::string_view name, uint16_t arguments, label ret);
+	void return_inline();
+
+	const std::string &static_label(std::string_view file, uint16_t index);
+
+	// Operands are passed by their index in m_operands.
+	bool reads_memory(std::size_t i) const;
+	bool direct(const operand &o) const;
+	void address(const operand &o);
+	void evaluate(std::size_t i);
+	void combine(vm::arithmetic_op op, std::size_t left, std::size_t right);
 };
 
-code::code(const std::string &file, std::ostream &os)
-	: m_p(new ::code_p(os))
+code::code(const std::string &file, std::ostream &os, const options &opts)
+	: m_p(new ::code_p(&os, opts))
+{
+	fs::path p(file);
+	m_p->set_static_label(p.stem().string());
+}
+
+code::code(const std::string &file, const options &opts)
+	: m_p(new ::code_p(nullptr, opts))
 {
 	fs::path p(file);
 	m_p->set_static_label(p.stem().string());
@@ -83,21 +209,26 @@ code::code(const std::string &file, std::ostream &os)
 
 code::~code() = default;
 
-void code::write_arithmetic(const std::string &cmd)
+void code::write_arithmetic(vm::arithmetic_op op)
 {
-	m_p->eval_arithmetic(cmd);
+	if (!m_p->defer_arithmetic(op))
+		m_p->eval_arithmetic(op);
 }
 
-void code::write_push_pop(command_type cmd, const std::string &segment, uint16_t index)
+void code::write_push_pop(command_type cmd, vm::segment segment, uint16_t index, std::string_view file)
 {
 	switch(cmd) {
 	case command_type::c_push:
-		m_p->eval_push_pop(cmd, segment, index);
+		if (m_p->defer_push(segment, index, file))
+			break;
+		m_p->eval_push_pop(cmd, segment, index, file);
 		m_p->sp_inc();
 		break;
 	case command_type::c_pop:
+		if (m_p->defer_pop(segment, index, file))
+			break;
 		m_p->sp_dec();
-		m_p->eval_push_pop(cmd, segment, index);
+		m_p->eval_push_pop(cmd, segment, index, file);
 		break;
 	default:
 		BOOST_ASSERT_MSG(false, "Wrong command_type for push_pop functions.");
@@ -105,21 +236,25 @@ void code::write_push_pop(command_type cmd, const std::string &segment, uint16_t
 	}
 }
 
-void code::write_label_command(vm::command_type cmd, const std::string &label)
+void code::write_label_command(vm::command_type cmd, std::string_view label)
 {
-	std::string local_label = "LOCALLABEL$" + label;
+	const std::string &local_label = m_p->label_scope();
 
 	switch(cmd) {
 	case command_type::c_label:
-		m_p->label_add(local_label);
+		m_p->spill();
+		m_p->label_add(local_label, label);
 		break;
 	case command_type::c_goto:
-		m_p->label_jump_with_comp("0", "JMP", local_label);
+		m_p->spill();
+		m_p->label_jump_with_comp("0", "JMP", local_label, label);
 		break;
 	case command_type::c_if:
+		if (m_p->defer_if(local_label, label))
+			break;
 		m_p->sp_dec();
 		m_p->stack_to_dest("D");
-		m_p->label_jump_with_comp("D", "JGT", local_label);
+		m_p->label_jump_with_comp("D", "JNE", local_label, label);
 		break;
 	default:
 		BOOST_ASSERT_MSG(false, "Wrong command_type for label functions.");
@@ -127,56 +262,117 @@ void code::write_label_command(vm::command_type cmd, const std::string &label)
 	}
 }
 
+void code::write_function(std::string_view name, uint16_t locals)
+{
+	m_p->spill();
+	m_p->eval_function(name, locals);
+}
+
+void code::write_call(std::string_view name, uint16_t arguments)
+{
+	m_p->spill();
+	m_p->eval_call(name, arguments);
+}
+
+void code::write_return()
+{
+	m_p->spill();
+	m_p->eval_return();
+}
+
+void code::write_init()
+{
+	m_p->eval_init();
+}
+
+unsigned code::routines() const
+{
+	return m_p->routines();
+}
+
+void code::write_routines(unsigned routines)
+{
+	m_p->write_routines(routines);
+}
+
+void code::flush()
+{
+	m_p->spill();
+	m_p->flush();
+}
+
+std::string code::release()
+{
+	m_p->spill();
+	return m_p->release();
+}
+
+std::size_t code::emitted() const
+{
+	return m_p->peephole().emitted();
+}
+
+std::size_t code::instructions() const
+{
+	return m_p->peephole().instructions();
+}
+
 /************** Private Class **************/
 
-code_p::code_p(std::ostream &ostream)
+code_p::code_p(std::ostream *ostream, const code::options &opts)
 	: m_ostream(ostream),
+	  m_peephole(opts.optimize > 0),
 	  m_label_count(0),
-	  m_label_static_name("STATIC")
-{
-	m_push_pop_function = {
-		{ "constant", &code_p::push_pop_constant },
-		{ "local", &code_p::push_pop_local },
-		{ "argument", &code_p::push_pop_argument },
-		{ "this", &code_p::push_pop_this },
-		{ "that", &code_p::push_pop_that },
-		{ "temp", &code_p::push_pop_temp },
-		{ "pointer", &code_p::push_pop_pointer },
-		{ "static", &code_p::push_pop_static },
-	};
-
-	m_arithmetic_function = {
-		{ "add", &code_p::arithmetic_add },
-		{ "sub", &code_p::arithmetic_sub },
-		{ "neg", &code_p::arithmetic_neg },
-		{ "eq", &code_p::arithmetic_eq },
-		{ "gt", &code_p::arithmetic_gt },
-		{ "lt", &code_p::arithmetic_lt },
-		{ "and", &code_p::arithmetic_and },
-		{ "or", &code_p::arithmetic_or },
-		{ "not", &code_p::arithmetic_not },
-	};
+	  m_label_static_name("STATIC"),
+	  m_label_prefix("VMLABEL"),
+	  m_label_scope("LOCALLABEL$"),
+	  m_shared_comparisons(opts.shared_comparisons),
+	  m_shared_calls(opts.shared_calls),
+	  m_routines(0),
+	  m_defer(opts.optimize >= 2)
+{
 }
 
+const code_p::command_function code_p::s_push_pop_function[] = {
+	&code_p::push_pop_constant,
+	&code_p::push_pop_local,
+	&code_p::push_pop_argument,
+	&code_p::push_pop_this,
+	&code_p::push_pop_that,
+	&code_p::push_pop_temp,
+	&code_p::push_pop_pointer,
+	&code_p::push_pop_static,
+};
+
+const code_p::arithmetic_function code_p::s_arithmetic_function[] = {
+	&code_p::arithmetic_add,
+	&code_p::arithmetic_sub,
+	&code_p::arithmetic_neg,
+	&code_p::arithmetic_eq,
+	&code_p::arithmetic_gt,
+	&code_p::arithmetic_lt,
+	&code_p::arithmetic_and,
+	&code_p::arithmetic_or,
+	&code_p::arithmetic_not,
+};
+
 void code_p::set_static_label(const std::string &label)
 {
-	m_label_static_name = "STATIC" + label;;
-	m_label_static_name.erase(std::remove_if(m_label_static_name.begin(), m_label_static_name.end(), ::isspace),
-	                          m_label_static_name.end());
+	m_label_static_name = static_name(label);
+
+	// Files are translated independently, so generated labels carry the file name too.
+	m_label_prefix = "VMLABEL" + m_label_static_name.substr(6) + "$";
 }
 
-void code_p::eval_push_pop(vm::command_type cmd, const std::string &segment, uint16_t index)
+void code_p::eval_push_pop(vm::command_type cmd, vm::segment segment, uint16_t index, std::string_view file)
 {
-	auto func = m_push_pop_function[segment];
-	if (func)
-		(this->*func)(cmd, index);
+	m_static_file = file;
+	(this->*s_push_pop_function[static_cast<std::size_t>(segment)])(cmd, index);
 }
 
-void code_p::eval_arithmetic(const std::string &cmd)
+void code_p::eval_arithmetic(vm::arithmetic_op op)
 {
-	auto func = m_arithmetic_function[cmd];
-	if (func)
-		(this->*func)();
+	(this->*s_arithmetic_function[static_cast<std::size_t>(op)])();
 }
 
 inline void code_p::sp_inc()
@@ -191,36 +387,67 @@ inline void code_p::sp_dec()
 	w("M=M-1");
 }
 
-inline void code_p::w(const std::string &command)
+// Commands are buffered for the peephole pass until flush().
+template<typename... T>
+inline void code_p::w(const T &... parts)
+{
+	m_peephole.push({ std::string_view(parts)... });
+}
+
+// The whole file goes out in one block.
+void code_p::flush()
+{
+	BOOST_ASSERT_MSG(m_ostream, "No output stream to flush to.");
+
+	const std::string &text = m_peephole.text();
+	m_ostream->write(text.data(), text.size());
+}
+
+std::string code_p::release()
 {
-	m_ostream << command << std::endl;
+	return m_peephole.release();
+}
+
+const vm::peephole &code_p::peephole() const
+{
+	return m_peephole;
+}
+
+unsigned code_p::routines() const
+{
+	return m_routines;
+}
+
+const std::string &code_p::label_scope() const
+{
+	return m_label_scope;
 }
 
 /************** Commands **************/
 
-inline void code_p::comp_to_stack(const std::string &comp)
+inline void code_p::comp_to_stack(std::string_view comp)
 {
 	label_at("SP");
 	w("A=M");
-	w("M=" + comp);
+	w("M=", comp);
 }
 
-inline void code_p::stack_to_dest(const std::string &dest)
+inline void code_p::stack_to_dest(std::string_view dest)
 {
 	label_at("SP");
 	w("A=M");
-	w(dest + "=M");
+	w(dest, "=M");
 }
 
-inline void code_p::seg_to_desc(const std::string &dest, const std::string &label, uint16_t index)
+inline void code_p::seg_to_desc(std::string_view dest, std::string_view label, uint16_t index)
 {
 	load_constant(index);
 	label_at(label);
 	w("A=D+M");
-	w(dest + "=M");
+	w(dest, "=M");
 }
 
-inline void code_p::load_seg(const std::string &label, uint16_t index)
+inline void code_p::load_seg(std::string_view label, uint16_t index)
 {
 	load_constant(index);
 	label_at(label);
@@ -233,52 +460,352 @@ inline void code_p::load_constant(uint16_t constant)
 	w("D=A");
 }
 
-inline void code_p::comp_to_reg(const std::string &comp, const std::string &reg)
+inline void code_p::comp_to_reg(std::string_view comp, std::string_view reg)
 {
 	label_at(reg);
-	w("M=" + comp);
+	w("M=", comp);
 }
 
-inline void code_p::reg_to_dest(const std::string &dest, const std::string &reg)
+inline void code_p::reg_to_dest(std::string_view dest, std::string_view reg)
 {
 	label_at(reg);
-	w(dest + "=M");
+	w(dest, "=M");
 }
 
 /************** Label **************/
 
-inline std::string code_p::label_create()
+inline code_p::label code_p::label_create()
 {
-	return "VMLABEL" + std::to_string(m_label_count++);
+	return label{ m_label_count++ };
 }
 
-template<typename T>
-inline void code_p::label_add(const T &label)
+template<typename... T>
+inline void code_p::label_add(const T &... parts)
 {
-	std::ostringstream oss;
-	oss << "(" << label << ")";
-	w(oss.str());
+	w("(", parts..., ")");
 }
 
-template<typename T>
-inline void code_p::label_at(const T &label)
+inline void code_p::label_add(label label)
 {
-	std::ostringstream oss;
-	oss << "@" << label;
-	w(oss.str());
+	label_add(m_label_prefix, decimal(label.number));
 }
 
-void code_p::label_jump_with_comp(const std::string &comp, const std::string &jmp, const std::string &label)
+template<typename... T>
+inline void code_p::label_at(const T &... parts)
 {
+	w("@", parts...);
+}
+
+inline void code_p::label_at(label label)
+{
+	label_at(m_label_prefix, decimal(label.number));
+}
+
+inline void code_p::label_at(uint16_t constant)
+{
+	label_at(decimal(constant));
+}
+
+template<typename... T>
+void code_p::label_jump_with_comp(std::string_view comp, std::string_view jmp, const T &... label)
+{
+	label_at(label...);
+	w(comp, ";", jmp);
+}
+
+/************** Shared Routines **************/
+
+static const char *routine_label(code::routine routine)
+{
+	switch (routine) {
+	case code::routine_eq:
+		return "VM$EQ";
+	case code::routine_gt:
+		return "VM$GT";
+	case code::routine_lt:
+		return "VM$LT";
+	case code::routine_call:
+		return "VM$CALL";
+	case code::routine_return:
+		return "VM$RETURN";
+	}
+	return nullptr;
+}
+
+// The return address is passed in D: @RET, D=A, @VM$EQ, 0;JMP, (RET)
+void code_p::call_routine(code::routine routine, label label)
+{
+	m_routines |= routine;
+
 	label_at(label);
-	w(comp + ";" + jmp);
+	w("D=A");
+	label_jump_with_comp("0", "JMP", routine_label(routine));
+	label_add(label);
+}
+
+/**
+ * Each comparison routine saves its return address to R14, stores false
+ * over X and only branches to the shared VM$TRUE tail when X <op> Y holds.
+ * The routines are placed behind a halt loop, so a program running off its
+ * last command never falls into them.
+ */
+void code_p::write_routines(unsigned routines)
+{
+	static const struct {
+		code::routine routine;
+		const char *jump;
+	} comparisons[] = {
+		{ code::routine_eq, "JEQ" },
+		{ code::routine_gt, "JGT" },
+		{ code::routine_lt, "JLT" },
+	};
+
+	if (!routines)
+		return;
+
+	label_add("VM$HALT");
+	label_jump_with_comp("0", "JMP", "VM$HALT");
+
+	if (routines & code::routine_call)
+		write_call_routine();
+	if (routines & code::routine_return)
+		write_return_routine();
+
+	if (!(routines & (code::routine_eq | code::routine_gt | code::routine_lt)))
+		return;
+
+	for (const auto &comparison : comparisons) {
+		if (!(routines & comparison.routine))
+			continue;
+
+		label_add(routine_label(comparison.routine));
+		comp_to_reg("D", "R14");
+		label_at("SP");
+		w("AM=M-1");
+		w("D=M");
+		w("A=A-1");
+		w("D=M-D");
+		w("M=0");
+		label_jump_with_comp("D", comparison.jump, "VM$TRUE");
+		reg_to_dest("A", "R14");
+		w("0;JMP");
+	}
+
+	label_add("VM$TRUE");
+	label_at("SP");
+	w("A=M-1");
+	w("M=-1");
+	reg_to_dest("A", "R14");
+	w("0;JMP");
+}
+
+/**
+ * VM$CALL pushes the return address from D and the caller's LCL, ARG, THIS
+ * and THAT, then points ARG at the R13 arguments below the frame and LCL at
+ * SP, and jumps to the callee in R14.
+ */
+void code_p::write_call_routine()
+{
+	label_add(routine_label(code::routine_call));
+	comp_to_stack("D");
+
+	for (std::string_view reg : { "LCL", "ARG", "THIS", "THAT" }) {
+		reg_to_dest("D", reg);
+		label_at("SP");
+		w("AM=M+1");
+		w("M=D");
+	}
+
+	label_at("SP");
+	w("MD=M+1");
+	comp_to_reg("D", "LCL");
+	label_at("5");
+	w("D=D-A");
+	label_at("R13");
+	w("D=D-M");
+	comp_to_reg("D", "ARG");
+	reg_to_dest("A", "R14");
+	w("0;JMP");
+}
+
+/**
+ * VM$RETURN keeps the return address in R14 before the return value
+ * overwrites it (a function without arguments), then restores the caller's
+ * segment pointers walking LCL down the saved frame.
+ */
+void code_p::write_return_routine()
+{
+	label_add(routine_label(code::routine_return));
+	load_constant(5);
+	label_at("LCL");
+	w("A=M-D");
+	w("D=M");
+	comp_to_reg("D", "R14");
+
+	label_at("SP");
+	w("AM=M-1");
+	w("D=M");
+	label_at("ARG");
+	w("A=M");
+	w("M=D");
+	reg_to_dest("D", "ARG");
+	label_at("SP");
+	w("M=D+1");
+
+	for (std::string_view reg : { "THAT", "THIS", "ARG" }) {
+		label_at("LCL");
+		w("AM=M-1");
+		w("D=M");
+		comp_to_reg("D", reg);
+	}
+	label_at("LCL");
+	w("A=M-1");
+	w("D=M");
+	comp_to_reg("D", "LCL");
+
+	reg_to_dest("A", "R14");
+	w("0;JMP");
+}
+
+/************** Functions **************/
+
+/**
+ * The locals are cleared in place and SP moved past them once:
+ *
+ *   (f), @SP, A=M, M=0, A=A+1, M=0, ..., D=A+1, @SP, M=D
+ *
+ * Labels inside the function are scoped as f$label.
+ */
+void code_p::eval_function(std::string_view name, uint16_t locals)
+{
+	m_label_scope.assign(name).push_back('$');
+	label_add(name);
+
+	if (locals == 0)
+		return;
+
+	label_at("SP");
+	w("A=M");
+	w("M=0");
+	for (uint16_t i = 1; i < locals; i++) {
+		w("A=A+1");
+		w("M=0");
+	}
+
+	if (locals == 1) {
+		sp_inc();
+		return;
+	}
+	w("D=A+1");
+	comp_to_reg("D", "SP");
+}
+
+/**
+ * call f n passes the argument count in R13 and the callee in R14 to the
+ * shared frame routine, which returns to RET:
+ *
+ *   @n, D=A, @R13, M=D, @f, D=A, @R14, M=D, @RET, D=A, @VM$CALL, 0;JMP, (RET)
+ */
+void code_p::eval_call(std::string_view name, uint16_t arguments)
+{
+	label ret = label_create();
+
+	if (!m_shared_calls) {
+		call_inline(name, arguments, ret);
+		return;
+	}
+
+	if (arguments <= 1)
+		comp_to_reg(arguments ? "1" : "0", "R13");
+	else {
+		load_constant(arguments);
+		comp_to_reg("D", "R13");
+	}
+	label_at(name);
+	w("D=A");
+	comp_to_reg("D", "R14");
+	call_routine(code::routine_call, ret);
+}
+
+void code_p::eval_return()
+{
+	if (!m_shared_calls) {
+		return_inline();
+		return;
+	}
+
+	m_routines |= code::routine_return;
+	label_jump_with_comp("0", "JMP", routine_label(code::routine_return));
+}
+
+void code_p::eval_init()
+{
+	load_constant(256);
+	comp_to_reg("D", "SP");
+	eval_call("Sys.init", 0);
+}
+
+// The textbook expansion: push RET, LCL, ARG, THIS, THAT,
+// ARG = SP - n - 5, LCL = SP, goto f, (RET)
+void code_p::call_inline(std::string_view name, uint16_t arguments, label ret)
+{
+	label_at(ret);
+	w("D=A");
+	comp_to_stack("D");
+	sp_inc();
+
+	for (std::string_view reg : { "LCL", "ARG", "THIS", "THAT" }) {
+		reg_to_dest("D", reg);
+		comp_to_stack("D");
+		sp_inc();
+	}
+
+	reg_to_dest("D", "SP");
+	label_at(static_cast<uint16_t>(arguments + 5));
+	w("D=D-A");
+	comp_to_reg("D", "ARG");
+	reg_to_dest("D", "SP");
+	comp_to_reg("D", "LCL");
+
+	label_jump_with_comp("0", "JMP", name);
+	label_add(ret);
+}
+
+// The textbook expansion with FRAME in R13 and RET in R14.
+void code_p::return_inline()
+{
+	reg_to_dest("D", "LCL");
+	comp_to_reg("D", "R13");
+	label_at("5");
+	w("A=D-A");
+	w("D=M");
+	comp_to_reg("D", "R14");
+
+	sp_dec();
+	stack_to_dest("D");
+	label_at("ARG");
+	w("A=M");
+	w("M=D");
+	reg_to_dest("D", "ARG");
+	label_at("SP");
+	w("M=D+1");
+
+	for (std::string_view reg : { "THAT", "THIS", "ARG", "LCL" }) {
+		label_at("R13");
+		w("AM=M-1");
+		w("D=M");
+		comp_to_reg("D", reg);
+	}
+
+	reg_to_dest("A", "R14");
+	w("0;JMP");
 }
 
 // Private API
 
 /************** Push and Pop **************/
 
-void code_p::push_pop_seg(const std::string &seg, command_type cmd, uint16_t index)
+void code_p::push_pop_seg(std::string_view seg, command_type cmd, uint16_t index)
 {
 	switch (cmd) {
 	case command_type::c_push:
@@ -297,7 +824,7 @@ void code_p::push_pop_seg(const std::string &seg, command_type cmd, uint16_t ind
 	}
 }
 
-void code_p::push_pop_reg(const std::string &reg, command_type cmd, uint16_t index)
+void code_p::push_pop_reg(std::string_view reg, command_type cmd, uint16_t index)
 {
 	switch (cmd) {
 	case command_type::c_push:
@@ -344,23 +871,35 @@ void code_p::push_pop_that(command_type cmd, uint16_t index)
 void code_p::push_pop_temp(command_type cmd, uint16_t index)
 {
 	BOOST_ASSERT_MSG(index < 8, "There are only 8 (0-7) temp indexes.");
-	push_pop_reg("R" + std::to_string(5 + index), cmd, index);
+	push_pop_reg(registers[5 + index], cmd, index);
 }
 
 void code_p::push_pop_pointer(command_type cmd, uint16_t index)
 {
 	BOOST_ASSERT_MSG(index < 2, "There are only 2 (0-1) pointer indexes.");
-	push_pop_reg("R" + std::to_string(3 + index), cmd, index);
+	push_pop_reg(registers[3 + index], cmd, index);
 }
 
 void code_p::push_pop_static(command_type cmd, uint16_t index)
 {
-	std::string static_label = m_label_static_name + std::to_string(index);
+	const std::string &label = static_label(m_static_file, index);
 
 	if (cmd == command_type::c_push)
-		label_at(static_label);
+		label_at(label);
 
-	push_pop_reg(static_label, cmd, index);
+	push_pop_reg(label, cmd, index);
+}
+
+// Built in a member so the name does not allocate every time, unless the
+// variable belongs to another file.
+const std::string &code_p::static_label(std::string_view file, uint16_t index)
+{
+	if (file.empty())
+		m_static_label.assign(m_label_static_name);
+	else
+		m_static_label.assign(static_name(fs::path(std::string(file)).stem().string()));
+	m_static_label.append(decimal(index));
+	return m_static_label;
 }
 
 /************** Arithmetics **************/
@@ -410,9 +949,14 @@ inline void code_p::arithmetic_neg()
 // X = (X == Y)
 inline void code_p::arithmetic_eq()
 {
-	std::string eq_label = label_create();
-	std::string neq_label = label_create();
-	std::string end_label = label_create();
+	if (m_shared_comparisons) {
+		call_routine(code::routine_eq, label_create());
+		return;
+	}
+
+	label eq_label = label_create();
+	label neq_label = label_create();
+	label end_label = label_create();
 
 	label_at("SP");
 	w("AM=M-1");
@@ -445,9 +989,14 @@ inline void code_p::arithmetic_eq()
 // X = (X > Y)
 inline void code_p::arithmetic_gt()
 {
-	std::string gt_label = label_create();
-	std::string le_label = label_create();
-	std::string end_label = label_create();
+	if (m_shared_comparisons) {
+		call_routine(code::routine_gt, label_create());
+		return;
+	}
+
+	label gt_label = label_create();
+	label le_label = label_create();
+	label end_label = label_create();
 
 	label_at("SP");
 	w("AM=M-1");
@@ -480,9 +1029,14 @@ inline void code_p::arithmetic_gt()
 // X = (X < Y)
 inline void code_p::arithmetic_lt()
 {
-	std::string lt_label = label_create();
-	std::string ge_label = label_create();
-	std::string end_label = label_create();
+	if (m_shared_comparisons) {
+		call_routine(code::routine_lt, label_create());
+		return;
+	}
+
+	label lt_label = label_create();
+	label ge_label = label_create();
+	label end_label = label_create();
 
 	label_at("SP");
 	w("AM=M-1");
@@ -537,3 +1091,340 @@ inline void code_p::arithmetic_not()
 	w("A=M-1");
 	w("M=!M");
 }
+
+/************** Deferred Operands **************/
+
+namespace {
+	std::string_view segment_base(vm::segment segment)
+	{
+		switch (segment) {
+		case vm::segment::local:
+			return "LCL";
+		case vm::segment::argument:
+			return "ARG";
+		case vm::segment::this_:
+			return "THIS";
+		case vm::segment::that:
+			return "THAT";
+		default:
+			return std::string_view();
+		}
+	}
+
+	bool comparison(vm::arithmetic_op op)
+	{
+		return op == arithmetic_op::eq || op == arithmetic_op::gt || op == arithmetic_op::lt;
+	}
+
+	// Jump taken when the comparison holds, or when it does not.
+	std::string_view comparison_jump(vm::arithmetic_op op, bool holds)
+	{
+		switch (op) {
+		case arithmetic_op::eq:
+			return holds ? "JEQ" : "JNE";
+		case arithmetic_op::gt:
+			return holds ? "JGT" : "JLE";
+		default:
+			return holds ? "JLT" : "JGE";
+		}
+	}
+} // namespace
+
+bool code_p::defer_push(vm::segment segment, uint16_t index, std::string_view file)
+{
+	if (!m_defer)
+		return false;
+
+	if (m_deferred.size() == s_max_deferred)
+		spill();
+	if (m_deferred.empty())
+		m_operands.clear();
+
+	operand o = operand();
+	o.kind = segment == vm::segment::constant ? operand::kind::constant : operand::kind::variable;
+	o.segment = segment;
+	o.index = index;
+	o.file = file;
+
+	m_deferred.push_back(m_operands.size());
+	m_operands.push_back(o);
+	return true;
+}
+
+bool code_p::defer_arithmetic(vm::arithmetic_op op)
+{
+	const std::size_t arity = op == arithmetic_op::neg || op == arithmetic_op::not_ ? 1 : 2;
+
+	if (!m_defer)
+		return false;
+	if (m_deferred.size() < arity) {
+		spill();
+		return false;
+	}
+
+	operand o = operand();
+	o.kind = operand::kind::operation;
+	o.op = op;
+	o.right = m_deferred.back();
+	m_deferred.pop_back();
+	if (arity == 2) {
+		o.left = m_deferred.back();
+		m_deferred.pop_back();
+	}
+
+	m_deferred.push_back(m_operands.size());
+	m_operands.push_back(o);
+	return true;
+}
+
+/**
+ * Stores the top operand straight into the variable. The operands below it
+ * are spilled first if they read memory, which the store may change.
+ */
+bool code_p::defer_pop(vm::segment segment, uint16_t index, std::string_view file)
+{
+	if (!m_defer || m_deferred.empty() || segment == vm::segment::constant) {
+		spill();
+		return false;
+	}
+
+	const std::size_t value = m_deferred.back();
+	m_deferred.pop_back();
+
+	for (std::size_t o : m_deferred) {
+		if (reads_memory(o)) {
+			spill();
+			break;
+		}
+	}
+
+	operand target = operand();
+	target.kind = operand::kind::variable;
+	target.segment = segment;
+	target.index = index;
+	target.file = file;
+
+	if (direct(target)) {
+		evaluate(value);
+		address(target);
+		w("M=D");
+		return true;
+	}
+
+	load_seg(segment_base(segment), index);
+	comp_to_reg("D", "R13");
+	evaluate(value);
+	reg_to_dest("A", "R13");
+	w("M=D");
+	return true;
+}
+
+// A comparison, or its negation, jumps on the difference directly.
+template<typename... T>
+bool code_p::defer_if(const T &... label)
+{
+	if (!m_defer || m_deferred.empty()) {
+		spill();
+		return false;
+	}
+
+	const std::size_t condition = m_deferred.back();
+	m_deferred.pop_back();
+	spill();
+
+	operand c = m_operands[condition];
+	bool holds = true;
+
+	if (c.kind == operand::kind::operation && c.op == arithmetic_op::not_ &&
+	    m_operands[c.right].kind == operand::kind::operation && comparison(m_operands[c.right].op)) {
+		c = m_operands[c.right];
+		holds = false;
+	}
+
+	if (c.kind == operand::kind::operation && comparison(c.op)) {
+		combine(arithmetic_op::sub, c.left, c.right);
+		label_jump_with_comp("D", comparison_jump(c.op, holds), label...);
+	} else {
+		evaluate(condition);
+		label_jump_with_comp("D", "JNE", label...);
+	}
+	return true;
+}
+
+// Writes the deferred operands to the stack, bottom first.
+void code_p::spill()
+{
+	for (std::size_t o : m_deferred) {
+		evaluate(o);
+		comp_to_stack("D");
+		sp_inc();
+	}
+	m_deferred.clear();
+}
+
+bool code_p::reads_memory(std::size_t i) const
+{
+	const operand &o = m_operands[i];
+
+	switch (o.kind) {
+	case operand::kind::constant:
+		return false;
+	case operand::kind::variable:
+		return true;
+	default:
+		return reads_memory(o.right) ||
+		       (o.op != arithmetic_op::neg && o.op != arithmetic_op::not_ && reads_memory(o.left));
+	}
+}
+
+// Constants and variables A can point at without going through D.
+bool code_p::direct(const operand &o) const
+{
+	switch (o.kind) {
+	case operand::kind::constant:
+		return true;
+	case operand::kind::variable:
+		return segment_base(o.segment).empty() || o.index <= 3;
+	default:
+		return false;
+	}
+}
+
+void code_p::address(const operand &o)
+{
+	switch (o.segment) {
+	case vm::segment::temp:
+		BOOST_ASSERT_MSG(o.index < 8, "There are only 8 (0-7) temp indexes.");
+		label_at(registers[5 + o.index]);
+		return;
+	case vm::segment::pointer:
+		BOOST_ASSERT_MSG(o.index < 2, "There are only 2 (0-1) pointer indexes.");
+		label_at(registers[3 + o.index]);
+		return;
+	case vm::segment::static_:
+		label_at(static_label(o.file, o.index));
+		return;
+	default:
+		label_at(segment_base(o.segment));
+		w(o.index == 0 ? "A=M" : "A=M+1");
+		for (uint16_t i = 1; i < o.index; i++)
+			w("A=A+1");
+	}
+}
+
+// D = value of the operand
+void code_p::evaluate(std::size_t i)
+{
+	const operand o = m_operands[i];
+
+	switch (o.kind) {
+	case operand::kind::constant:
+		if (o.index <= 1)
+			w(o.index ? "D=1" : "D=0");
+		else
+			load_constant(o.index);
+		return;
+	case operand::kind::variable:
+		if (direct(o)) {
+			address(o);
+			w("D=M");
+		} else
+			seg_to_desc("D", segment_base(o.segment), o.index);
+		return;
+	default:
+		break;
+	}
+
+	switch (o.op) {
+	case arithmetic_op::neg:
+	case arithmetic_op::not_:
+		evaluate(o.right);
+		w(o.op == arithmetic_op::neg ? "D=-D" : "D=!D");
+		return;
+	case arithmetic_op::eq:
+	case arithmetic_op::gt:
+	case arithmetic_op::lt: {
+		label holds = label_create();
+		label end = label_create();
+
+		combine(arithmetic_op::sub, o.left, o.right);
+		label_at(holds);
+		w("D;", comparison_jump(o.op, true));
+		w("D=0");
+		label_jump_with_comp("0", "JMP", end);
+		label_add(holds);
+		w("D=-1");
+		label_add(end);
+		return;
+	}
+	default:
+		combine(o.op, o.left, o.right);
+	}
+}
+
+/**
+ * D = left op right, for add, sub, and and or. Whichever side A can point
+ * at is taken from memory (or A, for a constant) with the other one in D;
+ * if neither can, the right one waits on the stack.
+ */
+void code_p::combine(vm::arithmetic_op op, std::size_t left, std::size_t right)
+{
+	static const struct {
+		vm::arithmetic_op op;
+		std::string_view comp;
+	} forms[] = {
+		{ arithmetic_op::add, "D=D+" },
+		{ arithmetic_op::sub, "D=D-" },
+		{ arithmetic_op::and_, "D=D&" },
+		{ arithmetic_op::or_, "D=D|" },
+	};
+
+	std::string_view form;
+	for (const auto &f : forms)
+		if (f.op == op)
+			form = f.comp;
+	BOOST_ASSERT_MSG(!form.empty(), "Not a binary operation.");
+
+	const operand l = m_operands[left];
+	const operand r = m_operands[right];
+
+	if (direct(r)) {
+		evaluate(left);
+		if (r.kind == operand::kind::constant) {
+			if (r.index == 1 && (op == arithmetic_op::add || op == arithmetic_op::sub)) {
+				w(op == arithmetic_op::add ? "D=D+1" : "D=D-1");
+				return;
+			}
+			label_at(r.index);
+			w(form, "A");
+		} else {
+			address(r);
+			w(form, "M");
+		}
+		return;
+	}
+
+	if (direct(l)) {
+		const std::string_view x = l.kind == operand::kind::constant ? "A" : "M";
+
+		evaluate(right);
+		if (l.kind == operand::kind::constant)
+			label_at(l.index);
+		else
+			address(l);
+		// Only sub is not commutative.
+		if (op == arithmetic_op::sub)
+			w("D=", x, "-D");
+		else
+			w(form, x);
+		return;
+	}
+
+	evaluate(right);
+	comp_to_stack("D");
+	sp_inc();
+	evaluate(left);
+	label_at("SP");
+	w("AM=M-1");
+	w(form, "M");
+}
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <memory>
 #include <ostream>
 
@@ -9,15 +10,66 @@ class code_p; // private class
 
 namespace vm {
 	enum class command_type;
+	enum class segment;
+	enum class arithmetic_op;
 
 	class code {
 	public:
-		code(const std::string &file, std::ostream &os);
+		// Code generation settings shared by every translated file.
+		struct options {
+			options() : optimize(1), shared_comparisons(false), shared_calls(true) {}
+
+			int optimize;
+			// Call the routines written by write_routines() for eq/gt/lt
+			// instead of expanding them inline.
+			bool shared_comparisons;
+			// Jump to the shared frame routines on call and return instead
+			// of saving and restoring the frame inline.
+			bool shared_calls;
+		};
+
+		// Shared routines called by the generated code.
+		enum routine : unsigned {
+			routine_eq = 1 << 0,
+			routine_gt = 1 << 1,
+			routine_lt = 1 << 2,
+			routine_call = 1 << 3,
+			routine_return = 1 << 4,
+		};
+
+		code(const std::string &file, std::ostream &os, const options &opts = options());
+		// Without a stream the assembly can only be taken with release().
+		code(const std::string &file, const options &opts);
 		~code();
 
-		void write_arithmetic(const std::string &cmd);
-		void write_push_pop(vm::command_type cmd, const std::string &segment, uint16_t index);
-		void write_label_command(vm::command_type cmd, const std::string &label);
+		void write_arithmetic(vm::arithmetic_op op);
+		// file names the owner of a static variable that is not this file's,
+		// as in code inlined from another file.
+		void write_push_pop(vm::command_type cmd, vm::segment segment, uint16_t index,
+		                    std::string_view file = std::string_view());
+		void write_label_command(vm::command_type cmd, std::string_view label);
+		void write_function(std::string_view name, uint16_t locals);
+		void write_call(std::string_view name, uint16_t arguments);
+		void write_return();
+
+		// Bootstrap code: SP = 256, call Sys.init.
+		void write_init();
+
+		// Routines called by this file, and the halt loop followed by the
+		// given routines, once after the last file.
+		unsigned routines() const;
+		void write_routines(unsigned routines);
+
+		// Writes the buffered assembly to the output stream.
+		void flush();
+
+		// Hands the buffered assembly over instead of writing it, one label
+		// or instruction per line.
+		std::string release();
+
+		// Number of instructions before and after optimization.
+		std::size_t emitted() const;
+		std::size_t instructions() const;
 
 	private:
 		std::unique_ptr<code_p> m_p;
@@ -13,4 +13,31 @@ namespace vm {
 		c_return,
 		c_call,
 	};
+
+	// Memory segments of push and pop, in the order of code's dispatch table.
+	enum class segment {
+		constant,
+		local,
+		argument,
+		this_,
+		that,
+		temp,
+		pointer,
+		static_,
+		count,
+	};
+
+	// Arithmetic and logical commands, in the order of code's dispatch table.
+	enum class arithmetic_op {
+		add,
+		sub,
+		neg,
+		eq,
+		gt,
+		lt,
+		and_,
+		or_,
+		not_,
+		count,
+	};
 } // namespace vm
@@ -0,0 +1,312 @@
+#include "inliner.h"
+
+#include <string>
+#include <unordered_map>
+
+using namespace vm;
+
+namespace {
+	// What the inliner needs to know about a function it may inline.
+	struct candidate {
+		const module *owner;
+		const function *body;
+		uint16_t arguments;
+		uint16_t locals;
+		bool sets_pointer[2];
+		uint16_t saves;
+		// Returns before the last command, which become a goto.
+		std::size_t early_returns;
+		// Estimated instructions of the body without its returns.
+		std::size_t size;
+	};
+
+	bool binary(arithmetic_op op)
+	{
+		return op != arithmetic_op::neg && op != arithmetic_op::not_;
+	}
+
+	// Instructions the translator generates for a command, give or take the
+	// peephole pass.
+	std::size_t estimate(const command &c)
+	{
+		switch (c.type) {
+		case command_type::c_push:
+			return c.segment == segment::local || c.segment == segment::argument ||
+			       c.segment == segment::this_ || c.segment == segment::that ? 8 : 7;
+		case command_type::c_pop:
+			return c.segment == segment::temp || c.segment == segment::pointer ||
+			       c.segment == segment::static_ ? 5 : 10;
+		case command_type::c_arithmetic:
+			switch (c.arithmetic) {
+			case arithmetic_op::eq:
+			case arithmetic_op::gt:
+			case arithmetic_op::lt:
+				return 13;
+			default:
+				return binary(c.arithmetic) ? 5 : 3;
+			}
+		case command_type::c_goto:
+			return 2;
+		case command_type::c_if:
+			return 5;
+		default:
+			return 0;
+		}
+	}
+
+	/**
+	 * Checks that the body leaves exactly the return value on the stack at
+	 * every return: every label is reached at one stack depth, the depth
+	 * never drops below the function's own stack and the body does not
+	 * fall off its end.
+	 */
+	bool balanced(const function &f)
+	{
+		std::unordered_map<std::string_view, int> depths;
+		int depth = 0;
+		bool reachable = true;
+
+		auto branch = [&depths](std::string_view label, int depth) {
+			return depths.emplace(label, depth).first->second == depth;
+		};
+
+		for (std::size_t i = 1; i < f.commands.size(); i++) {
+			const command &c = f.commands[i];
+
+			if (c.type == command_type::c_label) {
+				auto known = depths.find(c.name);
+				if (!reachable) {
+					// Only reached by a jump seen further up.
+					if (known == depths.end())
+						return false;
+					depth = known->second;
+					reachable = true;
+				} else if (!branch(c.name, depth))
+					return false;
+				continue;
+			}
+
+			if (!reachable)
+				continue;
+
+			switch (c.type) {
+			case command_type::c_push:
+				depth++;
+				break;
+			case command_type::c_pop:
+				depth--;
+				break;
+			case command_type::c_arithmetic:
+				if (binary(c.arithmetic))
+					depth--;
+				break;
+			case command_type::c_if:
+				if (!branch(c.name, --depth))
+					return false;
+				break;
+			case command_type::c_goto:
+				if (!branch(c.name, depth))
+					return false;
+				reachable = false;
+				break;
+			case command_type::c_return:
+				if (depth != 1)
+					return false;
+				reachable = false;
+				break;
+			default:
+				return false;
+			}
+
+			if (depth < 0)
+				return false;
+		}
+
+		return !reachable;
+	}
+
+	// Leaf functions of at most max_size commands that can be inlined.
+	bool inspect(const module &owner, const function &f, std::size_t max_size, candidate *c)
+	{
+		if (f.name.empty() || !f.reachable || f.commands.size() - 1 > max_size || !balanced(f))
+			return false;
+
+		*c = candidate();
+		c->owner = &owner;
+		c->body = &f;
+		c->locals = f.commands.front().index;
+
+		for (std::size_t i = 1; i < f.commands.size(); i++) {
+			const command &command = f.commands[i];
+
+			if (command.type == command_type::c_call)
+				return false;
+			if (command.type == command_type::c_return) {
+				if (i + 1 < f.commands.size())
+					c->early_returns++;
+				continue;
+			}
+			c->size += estimate(command);
+
+			if (command.type != command_type::c_push && command.type != command_type::c_pop)
+				continue;
+			if (command.segment == segment::argument && command.index >= c->arguments)
+				c->arguments = command.index + 1;
+			if (command.segment == segment::local && command.index >= c->locals)
+				return false;
+			if (command.segment == segment::pointer && command.type == command_type::c_pop && command.index < 2)
+				c->sets_pointer[command.index] = true;
+		}
+
+		c->saves = c->sets_pointer[0] + c->sets_pointer[1];
+		return true;
+	}
+
+	command make(command_type type, vm::segment segment, uint16_t index)
+	{
+		command c = command();
+		c.type = type;
+		c.segment = segment;
+		c.index = index;
+		return c;
+	}
+} // namespace
+
+inliner::inliner(std::size_t max_size, bool shared_calls)
+	: m_max_size(max_size),
+	  m_shared_calls(shared_calls)
+{
+}
+
+std::size_t inliner::run(std::vector<std::unique_ptr<module>> &modules)
+{
+	bool used[8] = {};
+	std::unordered_map<std::string_view, candidate> candidates;
+
+	for (const std::unique_ptr<module> &m : modules) {
+		for (const function &f : m->functions()) {
+			for (const command &c : f.commands)
+				if ((c.type == command_type::c_push || c.type == command_type::c_pop) &&
+				    c.segment == segment::temp && c.index < 8)
+					used[c.index] = true;
+
+			candidate c;
+			if (inspect(*m, f, m_max_size, &c))
+				candidates.emplace(f.name, c);
+		}
+	}
+
+	std::vector<uint16_t> free;
+	for (uint16_t i = 0; i < 8; i++)
+		if (!used[i])
+			free.push_back(i);
+
+	std::size_t sites = 0;
+
+	for (std::unique_ptr<module> &m : modules) {
+		for (function &f : m->functions()) {
+			std::vector<command> commands;
+			bool changed = false;
+
+			for (const command &c : f.commands) {
+				auto found = c.type == command_type::c_call ? candidates.find(c.name) : candidates.end();
+				if (found == candidates.end()) {
+					commands.push_back(c);
+					continue;
+				}
+
+				const candidate &callee = found->second;
+				const uint16_t arguments = c.index;
+
+				// Cycles of the call and return saved against the arguments
+				// and locals moved into registers instead, and the ROM the
+				// body costs over the call site.
+				const long moves = 5 * arguments + 4 * callee.locals + 8 * callee.saves +
+				                   2 * static_cast<long>(callee.early_returns);
+				const long call_size = m_shared_calls ? (arguments <= 1 ? 10 : 12) : 46;
+				const long call_cycles = m_shared_calls ? call_size + 37 + 2 + 40 : 87;
+				const long saved = call_cycles - moves;
+				const long growth = static_cast<long>(callee.size) + moves - call_size;
+
+				if (arguments < callee.arguments || static_cast<std::size_t>(arguments + callee.locals + callee.saves) > free.size() ||
+				    saved <= 0 || growth > saved) {
+					commands.push_back(c);
+					continue;
+				}
+
+				const uint16_t *argument = free.data();
+				const uint16_t *local = argument + arguments;
+				const uint16_t *save = local + callee.locals;
+				const std::string prefix = std::string(callee.body->name) + "$" + std::to_string(sites++);
+				bool early_return = false;
+
+				for (uint16_t p = 0, s = 0; p < 2; p++) {
+					if (callee.sets_pointer[p]) {
+						commands.push_back(make(command_type::c_push, segment::pointer, p));
+						commands.push_back(make(command_type::c_pop, segment::temp, save[s++]));
+					}
+				}
+				for (uint16_t i = arguments; i-- > 0; )
+					commands.push_back(make(command_type::c_pop, segment::temp, argument[i]));
+				for (uint16_t i = 0; i < callee.locals; i++) {
+					commands.push_back(make(command_type::c_push, segment::constant, 0));
+					commands.push_back(make(command_type::c_pop, segment::temp, local[i]));
+				}
+
+				const std::vector<command> &body = callee.body->commands;
+				for (std::size_t i = 1; i < body.size(); i++) {
+					command b = body[i];
+
+					switch (b.type) {
+					case command_type::c_push:
+					case command_type::c_pop:
+						if (b.segment == segment::argument) {
+							b.segment = segment::temp;
+							b.index = argument[b.index];
+						} else if (b.segment == segment::local) {
+							b.segment = segment::temp;
+							b.index = local[b.index];
+						} else if (b.segment == segment::static_ && callee.owner != m.get())
+							b.file = callee.owner->file_name();
+						break;
+					case command_type::c_label:
+					case command_type::c_goto:
+					case command_type::c_if:
+						b.name = m->intern(prefix + "$" + std::string(b.name));
+						break;
+					case command_type::c_return:
+						if (i + 1 == body.size())
+							continue;
+						b.type = command_type::c_goto;
+						b.name = m->intern(prefix);
+						early_return = true;
+						break;
+					default:
+						break;
+					}
+					commands.push_back(b);
+				}
+
+				if (early_return) {
+					command end = command();
+					end.type = command_type::c_label;
+					end.name = m->intern(prefix);
+					commands.push_back(end);
+				}
+
+				for (uint16_t p = 2, s = callee.saves; p-- > 0; ) {
+					if (callee.sets_pointer[p]) {
+						commands.push_back(make(command_type::c_push, segment::temp, save[--s]));
+						commands.push_back(make(command_type::c_pop, segment::pointer, p));
+					}
+				}
+				changed = true;
+			}
+
+			if (changed)
+				f.commands.swap(commands);
+		}
+	}
+
+	return sites;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "module.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace vm {
+	/**
+	 * Substitutes the body of small leaf functions for the calls to them,
+	 * before any code is generated.
+	 *
+	 * The arguments are popped into temp registers that no function of
+	 * the program uses, the locals are cleared in more of them, and the
+	 * callee's argument and local commands are remapped there. THIS and
+	 * THAT are saved in the same way when the callee sets pointer, since
+	 * a return would have restored them. A return leaves its value on the
+	 * caller's stack, so the callee's stack must hold exactly that value
+	 * at every return.
+	 *
+	 * A function is inlined when it has at most max_size commands and the
+	 * cycles saved per call outweigh the instructions added per call site,
+	 * both estimated from the code the translator generates. Needs the
+	 * whole program, as temp registers are global.
+	 */
+	class inliner {
+	public:
+		inliner(std::size_t max_size, bool shared_calls);
+
+		// Returns the number of call sites inlined.
+		std::size_t run(std::vector<std::unique_ptr<module>> &modules);
+
+	private:
+		std::size_t m_max_size;
+		bool m_shared_calls;
+	};
+} // namespace vm
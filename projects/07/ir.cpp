@@ -0,0 +1,194 @@
+#include "ir.h"
+
+using namespace vm;
+
+namespace {
+	// A stack slot written by the commands [start, ...) of the output, with
+	// its value if that is known.
+	struct slot {
+		std::size_t start;
+		bool known;
+		uint16_t value;
+	};
+
+	bool ends_block(command_type type)
+	{
+		return type == command_type::c_function || type == command_type::c_goto ||
+		       type == command_type::c_if || type == command_type::c_call ||
+		       type == command_type::c_return;
+	}
+
+	command make(command_type type, vm::segment segment, uint16_t index)
+	{
+		command c = command();
+		c.type = type;
+		c.segment = segment;
+		c.index = index;
+		return c;
+	}
+
+	// push constant takes 0..32767, and negation covers the rest but -32768.
+	bool expressible(uint16_t value)
+	{
+		return value != 0x8000;
+	}
+
+	void push_constant(std::vector<command> &out, uint16_t value)
+	{
+		if (value <= 0x7FFF) {
+			out.push_back(make(command_type::c_push, segment::constant, value));
+			return;
+		}
+
+		out.push_back(make(command_type::c_push, segment::constant, -value & 0xFFFF));
+		command neg = make(command_type::c_arithmetic, segment::constant, 0);
+		neg.arithmetic = arithmetic_op::neg;
+		out.push_back(neg);
+	}
+
+	uint16_t evaluate(arithmetic_op op, uint16_t x, uint16_t y)
+	{
+		const int16_t difference = static_cast<int16_t>(x - y);
+
+		switch (op) {
+		case arithmetic_op::add:
+			return x + y;
+		case arithmetic_op::sub:
+			return x - y;
+		case arithmetic_op::neg:
+			return -y;
+		case arithmetic_op::eq:
+			return difference == 0 ? 0xFFFF : 0;
+		case arithmetic_op::gt:
+			return difference > 0 ? 0xFFFF : 0;
+		case arithmetic_op::lt:
+			return difference < 0 ? 0xFFFF : 0;
+		case arithmetic_op::and_:
+			return x & y;
+		case arithmetic_op::or_:
+			return x | y;
+		case arithmetic_op::not_:
+			return ~y;
+		default:
+			return 0;
+		}
+	}
+
+	bool unary(arithmetic_op op)
+	{
+		return op == arithmetic_op::neg || op == arithmetic_op::not_;
+	}
+
+	// Folds one block of commands onto the end of out.
+	void fold_block(const command *begin, const command *end, std::vector<command> &out)
+	{
+		// Slots pushed within the block; anything below is unknown.
+		std::vector<slot> stack;
+
+		for (const command *c = begin; c != end; c++) {
+			switch (c->type) {
+			case command_type::c_push:
+				stack.push_back(slot{ out.size(), c->segment == segment::constant, c->index });
+				out.push_back(*c);
+				continue;
+			case command_type::c_pop:
+				// The slots below were written before the pop, so they can
+				// no longer be cut off the end of the output.
+				if (!stack.empty())
+					stack.pop_back();
+				for (slot &s : stack)
+					s.known = false;
+				out.push_back(*c);
+				continue;
+			case command_type::c_arithmetic: {
+				const std::size_t arity = unary(c->arithmetic) ? 1 : 2;
+
+				if (stack.size() < arity) {
+					stack.clear();
+					out.push_back(*c);
+					continue;
+				}
+
+				slot &x = stack[stack.size() - arity];
+				const slot &y = stack.back();
+
+				if (x.known && y.known && expressible(evaluate(c->arithmetic, x.value, y.value))) {
+					x.value = evaluate(c->arithmetic, x.value, y.value);
+					out.resize(x.start);
+					push_constant(out, x.value);
+					stack.resize(stack.size() - arity + 1);
+					continue;
+				}
+
+				// x + 0, x - 0 and x | 0 are x.
+				if (arity == 2 && y.known && y.value == 0 &&
+				    (c->arithmetic == arithmetic_op::add || c->arithmetic == arithmetic_op::sub ||
+				     c->arithmetic == arithmetic_op::or_)) {
+					out.resize(y.start);
+					stack.pop_back();
+					continue;
+				}
+
+				stack.resize(stack.size() - arity);
+				stack.push_back(slot{ x.start, false, 0 });
+				out.push_back(*c);
+				continue;
+			}
+			case command_type::c_if:
+				// A constant condition is a goto or nothing.
+				if (!stack.empty() && stack.back().known) {
+					const bool taken = stack.back().value != 0;
+					out.resize(stack.back().start);
+					stack.pop_back();
+					if (taken) {
+						command jump = *c;
+						jump.type = command_type::c_goto;
+						out.push_back(jump);
+					}
+					continue;
+				}
+				out.push_back(*c);
+				continue;
+			default:
+				out.push_back(*c);
+				continue;
+			}
+		}
+	}
+} // namespace
+
+std::vector<basic_block> vm::basic_blocks(const function &f)
+{
+	std::vector<basic_block> blocks;
+	std::size_t begin = 0;
+
+	for (std::size_t i = 0; i < f.commands.size(); i++) {
+		const command_type type = f.commands[i].type;
+
+		if (type == command_type::c_label && i > begin) {
+			blocks.push_back(basic_block{ begin, i });
+			begin = i;
+		}
+		if (ends_block(type)) {
+			blocks.push_back(basic_block{ begin, i + 1 });
+			begin = i + 1;
+		}
+	}
+	if (begin < f.commands.size())
+		blocks.push_back(basic_block{ begin, f.commands.size() });
+
+	return blocks;
+}
+
+std::size_t vm::fold_constants(function &f)
+{
+	std::vector<command> out;
+	out.reserve(f.commands.size());
+
+	for (const basic_block &b : basic_blocks(f))
+		fold_block(f.commands.data() + b.begin, f.commands.data() + b.end, out);
+
+	const std::size_t removed = f.commands.size() - out.size();
+	f.commands.swap(out);
+	return removed;
+}
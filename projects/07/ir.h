@@ -0,0 +1,29 @@
+#pragma once
+
+#include "module.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace vm {
+	/**
+	 * Commands [begin, end) of a function entered only at the first one and
+	 * left only after the last one. Blocks start at labels and after
+	 * function, goto, if-goto, call and return commands.
+	 */
+	struct basic_block {
+		std::size_t begin;
+		std::size_t end;
+	};
+
+	std::vector<basic_block> basic_blocks(const function &f);
+
+	/**
+	 * Tracks which stack slots hold constants through each basic block and
+	 * replaces arithmetic on them, and if-goto on a constant, with the
+	 * result. Results are computed the way the generated code does, 16-bit
+	 * with eq/gt/lt on the difference. Returns the number of commands
+	 * removed.
+	 */
+	std::size_t fold_constants(function &f);
+} // namespace vm
@@ -0,0 +1,98 @@
+#include "module.h"
+#include "parser.h"
+
+#include <unordered_map>
+#include <utility>
+
+using namespace vm;
+
+module::module(const std::string &file)
+	: m_file_name(file),
+	  m_parser(new parser(file))
+{
+	m_functions.emplace_back();
+
+	while (m_parser->has_more_commands()) {
+		m_parser->advance();
+		if (m_parser->command() == command_type::none)
+			continue;
+
+		command c;
+		c.type = m_parser->command();
+		c.segment = m_parser->segment();
+		c.arithmetic = m_parser->arithmetic();
+		c.name = m_parser->arg1();
+		c.index = m_parser->arg2();
+
+		if (c.type == command_type::c_function) {
+			m_functions.emplace_back();
+			m_functions.back().name = c.name;
+		}
+		m_functions.back().commands.push_back(c);
+	}
+}
+
+module::~module() = default;
+
+const std::string &module::file_name() const
+{
+	return m_file_name;
+}
+
+std::vector<function> &module::functions()
+{
+	return m_functions;
+}
+
+const std::vector<function> &module::functions() const
+{
+	return m_functions;
+}
+
+std::string_view module::intern(std::string name)
+{
+	m_names.push_back(std::move(name));
+	return m_names.back();
+}
+
+bool vm::mark_reachable(std::vector<std::unique_ptr<module>> &modules, std::string_view root)
+{
+	std::unordered_map<std::string_view, function *> functions;
+	std::vector<function *> pending;
+
+	for (std::unique_ptr<module> &m : modules) {
+		for (function &f : m->functions()) {
+			f.reachable = f.name.empty();
+			if (f.reachable)
+				pending.push_back(&f);
+			else
+				functions.emplace(f.name, &f);
+		}
+	}
+
+	auto found = functions.find(root);
+	if (found == functions.end())
+		return false;
+
+	pending.push_back(found->second);
+	found->second->reachable = true;
+
+	while (!pending.empty()) {
+		function *f = pending.back();
+		pending.pop_back();
+
+		for (const command &c : f->commands) {
+			if (c.type != command_type::c_call)
+				continue;
+
+			// Calls to undefined functions are left to the assembler.
+			auto callee = functions.find(c.name);
+			if (callee != functions.end() && !callee->second->reachable) {
+				callee->second->reachable = true;
+				pending.push_back(callee->second);
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "command_type.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace vm {
+	class parser;
+
+	// A parsed VM command. Names are views into the source of its module.
+	struct command {
+		vm::command_type type;
+		vm::segment segment;
+		vm::arithmetic_op arithmetic;
+		// Label, function or callee name.
+		std::string_view name;
+		uint16_t index;
+		// File a static variable belongs to if not the module's own.
+		std::string_view file;
+	};
+
+	// Commands of one function, starting with its function command.
+	struct function {
+		std::string_view name;
+		std::vector<command> commands;
+		bool reachable = true;
+	};
+
+	/**
+	 * One .vm file parsed up front, so passes can look at the whole program
+	 * before any code is generated. The commands before the first function
+	 * command, if any, are kept as a function without a name.
+	 */
+	class module {
+	public:
+		explicit module(const std::string &file);
+		~module();
+
+		const std::string &file_name() const;
+
+		std::vector<function> &functions();
+		const std::vector<function> &functions() const;
+
+		// Keeps a name made up by a pass alive as long as the module.
+		std::string_view intern(std::string name);
+
+	private:
+		std::string m_file_name;
+		// Owns the source the command names point into.
+		std::unique_ptr<parser> m_parser;
+		std::vector<function> m_functions;
+		std::deque<std::string> m_names;
+	};
+
+	/**
+	 * Marks the functions reachable from root through call commands and
+	 * everything else unreachable. Code outside functions is always kept,
+	 * together with what it calls.
+	 * Returns false if root is not defined.
+	 */
+	bool mark_reachable(std::vector<std::unique_ptr<module>> &modules, std::string_view root);
+} // namespace vm
@@ -1,16 +1,20 @@
 #include "parser.h"
 #include "command_type.h"
 
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/classification.hpp>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
 
 using namespace vm;
 
-parser::parser(const std::string &file)
-	: m_file(file, std::ifstream::in),
-	  m_command_type(command_type::none)
-{
-	m_command_lookup = {
+namespace {
+	template<typename T>
+	struct name {
+		std::string_view text;
+		T value;
+	};
+
+	const name<command_type> command_names[] = {
 		{ "add",      command_type::c_arithmetic },
 		{ "sub",      command_type::c_arithmetic },
 		{ "neg",      command_type::c_arithmetic },
@@ -29,49 +33,140 @@ parser::parser(const std::string &file)
 		{ "return",   command_type::c_return },
 		{ "call",     command_type::c_call },
 	};
-}
 
-parser::~parser()
+	const name<segment> segment_names[] = {
+		{ "constant", segment::constant },
+		{ "local",    segment::local },
+		{ "argument", segment::argument },
+		{ "this",     segment::this_ },
+		{ "that",     segment::that },
+		{ "temp",     segment::temp },
+		{ "pointer",  segment::pointer },
+		{ "static",   segment::static_ },
+	};
+
+	const name<arithmetic_op> arithmetic_names[] = {
+		{ "add", arithmetic_op::add },
+		{ "sub", arithmetic_op::sub },
+		{ "neg", arithmetic_op::neg },
+		{ "eq",  arithmetic_op::eq },
+		{ "gt",  arithmetic_op::gt },
+		{ "lt",  arithmetic_op::lt },
+		{ "and", arithmetic_op::and_ },
+		{ "or",  arithmetic_op::or_ },
+		{ "not", arithmetic_op::not_ },
+	};
+
+	// The handful of names makes a linear scan cheaper than hashing.
+	template<typename T, std::size_t N>
+	bool lookup(const name<T> (&names)[N], std::string_view text, T *value)
+	{
+		for (const name<T> &n : names) {
+			if (n.text == text) {
+				*value = n.value;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool blank(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+} // namespace
+
+parser::parser(const std::string &file)
+	: m_line(0),
+	  m_command_type(command_type::none),
+	  m_segment(vm::segment::constant),
+	  m_arithmetic(vm::arithmetic_op::add),
+	  m_index(0)
 {
-	if (m_file.is_open())
-		m_file.close();
+	std::ifstream ifs(file, std::ifstream::in | std::ifstream::binary);
+	if (!ifs)
+		throw std::runtime_error("cannot open " + file);
+
+	m_source.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+	m_pos = m_source.data();
+	m_end = m_pos + m_source.size();
 }
 
+parser::~parser() = default;
+
 bool parser::has_more_commands() const
 {
-	return m_file.good();
+	return m_pos < m_end;
 }
 
 void parser::advance()
 {
-	std::string line;
 	m_command_type = command_type::none;
-	do {
-		std::getline(m_file >> std::ws, line);
 
-		if (line.empty())
-			continue;
+	while (m_pos < m_end && m_command_type == command_type::none) {
+		const char *eol = m_pos;
+		while (eol < m_end && *eol != '\n')
+			eol++;
+
+		const char *p = m_pos;
+		m_pos = eol < m_end ? eol + 1 : eol;
+		m_line++;
+
+		// Split into at most three tokens up to the end of line or a comment.
+		std::size_t count = 0;
+		while (count < 3) {
+			while (p < eol && blank(*p))
+				p++;
+			if (p == eol || (p[0] == '/' && p + 1 < eol && p[1] == '/'))
+				break;
+
+			const char *begin = p;
+			while (p < eol && !blank(*p) && !(p[0] == '/' && p + 1 < eol && p[1] == '/'))
+				p++;
+			m_token[count++] = std::string_view(begin, p - begin);
+		}
 
-		// remove comments from string
-		std::string::size_type comment_pos = line.find("//");
+		if (count == 0)
+			continue;
 
-		// check if line has comments
-		if (comment_pos != 0) {
+		for (std::size_t i = count; i < 3; i++)
+			m_token[i] = std::string_view();
 
-			// remove comments if after command
-			if (comment_pos != std::string::npos)
-				line.erase(comment_pos);
+		if (!lookup(command_names, m_token[0], &m_command_type))
+			continue;
 
-			boost::split(m_token, line, boost::is_any_of(" \r\n"));
+		parse_arguments();
+	}
+}
 
-			m_command_type = m_command_lookup[m_token[0]];
+void parser::parse_arguments()
+{
+	switch (m_command_type) {
+	case command_type::c_arithmetic:
+		lookup(arithmetic_names, m_token[0], &m_arithmetic);
+		break;
+	case command_type::c_push:
+	case command_type::c_pop:
+		if (!lookup(segment_names, m_token[1], &m_segment))
+			throw std::runtime_error("line " + std::to_string(m_line) +
+			                         ": unknown segment: " + std::string(m_token[1]));
+		// fall through
+	case command_type::c_function:
+	case command_type::c_call: {
+		uint32_t value = 0;
+		if (m_token[2].empty())
+			throw std::runtime_error("line " + std::to_string(m_line) + ": missing index");
+		for (char c : m_token[2]) {
+			if (c < '0' || c > '9' || (value = value * 10 + (c - '0')) > 0xFFFF)
+				throw std::runtime_error("line " + std::to_string(m_line) +
+				                         ": invalid index: " + std::string(m_token[2]));
 		}
-	} while (m_file.good() && m_command_type == command_type::none);
-
-	// line.insert(0, "\"");
-	// line.insert(line.size()-1, "\"");
-
-	// std::cout << line << std::endl;
+		m_index = value;
+		break;
+	}
+	default:
+		break;
+	}
 }
 
 command_type parser::command() const
@@ -79,16 +174,14 @@ command_type parser::command() const
 	return m_command_type;
 }
 
-std::string parser::arg1() const
+std::string_view parser::arg1() const
 {
 	switch (m_command_type) {
 	case command_type::none:
 	case command_type::c_return:
-		return std::string("");
-		break;
+		return std::string_view();
 	case command_type::c_arithmetic:
 		return m_token[0];
-		break;
 	default:
 		return m_token[1];
 	}
@@ -101,8 +194,23 @@ uint16_t parser::arg2() const
 	case command_type::c_pop:
 	case command_type::c_function:
 	case command_type::c_call:
-		return std::stoi(m_token[2]);
+		return m_index;
 	default:
 		return -1;
 	}
 }
+
+segment parser::segment() const
+{
+	return m_segment;
+}
+
+arithmetic_op parser::arithmetic() const
+{
+	return m_arithmetic;
+}
+
+std::size_t parser::line() const
+{
+	return m_line;
+}
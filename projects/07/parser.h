@@ -2,13 +2,18 @@
 
 #include <cstdint>
 #include <string>
-#include <map>
-#include <vector>
-#include <fstream>
+#include <string_view>
 
 namespace vm {
 	enum class command_type;
+	enum class segment;
+	enum class arithmetic_op;
 
+	/**
+	 * Reads the whole file at once and splits each line in place into
+	 * views, so parsing a command allocates nothing. Command, segment and
+	 * operator names are mapped to enums as the line is parsed.
+	 */
 	class parser {
 	public:
 		parser(const std::string &file);
@@ -18,14 +23,27 @@ namespace vm {
 		void advance();
 
 		vm::command_type command() const;
-		std::string arg1() const;
+		std::string_view arg1() const;
 		uint16_t arg2() const;
 
+		// Segment of push/pop and operator of arithmetic commands.
+		vm::segment segment() const;
+		vm::arithmetic_op arithmetic() const;
+
+		// Source line of the current command.
+		std::size_t line() const;
+
 	private:
-		std::ifstream m_file;
-		std::string m_command;
-		std::vector<std::string> m_token;
+		std::string m_source;
+		const char *m_pos;
+		const char *m_end;
+		std::size_t m_line;
+		std::string_view m_token[3];
 		vm::command_type m_command_type;
-		std::map<std::string, vm::command_type> m_command_lookup;
+		vm::segment m_segment;
+		vm::arithmetic_op m_arithmetic;
+		uint16_t m_index;
+
+		void parse_arguments();
 	};
 }
@@ -0,0 +1,351 @@
+#include "peephole.h"
+
+#include <algorithm>
+#include <cctype>
+
+using namespace vm;
+
+namespace {
+	bool a_instruction(std::string_view line)
+	{
+		return !line.empty() && line[0] == '@';
+	}
+
+	bool jump(std::string_view line)
+	{
+		return line.find(';') != std::string_view::npos;
+	}
+
+	// Base pointers of the segments addressed indirectly (local, argument,
+	// this, that), as a view that survives rewriting the line it came from.
+	std::string_view segment_base(std::string_view line)
+	{
+		static const std::string_view bases[] = { "@LCL", "@ARG", "@THIS", "@THAT" };
+
+		for (std::string_view base : bases)
+			if (line == base)
+				return base;
+		return std::string_view();
+	}
+
+	// Value of a numeric A-instruction, or -1 for a symbol.
+	long constant(std::string_view line)
+	{
+		if (line.size() < 2 || line[0] != '@')
+			return -1;
+
+		long value = 0;
+		for (char c : line.substr(1)) {
+			if (!std::isdigit(static_cast<unsigned char>(c)))
+				return -1;
+			value = value * 10 + (c - '0');
+		}
+		return value;
+	}
+
+	// The jump taken when the given comparison is false.
+	const char *complement(std::string_view jump)
+	{
+		if (jump == "D;JEQ")
+			return "D;JNE";
+		if (jump == "D;JGT")
+			return "D;JLE";
+		if (jump == "D;JLT")
+			return "D;JGE";
+		return nullptr;
+	}
+} // namespace
+
+peephole::peephole(bool enabled)
+	: m_enabled(enabled),
+	  m_emitted(0),
+	  m_instructions(0),
+	  m_tail_size(0)
+{
+}
+
+void peephole::push(std::initializer_list<std::string_view> parts)
+{
+	if (parts.begin()->front() != '(')
+		m_emitted++;
+
+	m_starts.push_back(m_text.size());
+	for (std::string_view part : parts)
+		m_text.append(part);
+	m_text.push_back('\n');
+
+	if (m_enabled)
+		while (fold())
+			;
+}
+
+const std::string &peephole::text() const
+{
+	return m_text;
+}
+
+std::size_t peephole::emitted() const
+{
+	return m_emitted;
+}
+
+// The released output is gone, but still counts.
+std::string peephole::release()
+{
+	std::string text;
+
+	m_instructions = instructions();
+	m_starts.clear();
+	text.swap(m_text);
+	return text;
+}
+
+std::size_t peephole::instructions() const
+{
+	std::size_t count = m_instructions;
+	for (std::size_t start : m_starts)
+		if (m_text[start] != '(')
+			count++;
+	return count;
+}
+
+/**
+ * Applies the first rule that matches the tail of the output. Longer
+ * patterns come first, so a shorter rule does not break them up half way.
+ */
+bool peephole::fold()
+{
+	const std::string_view *t;
+
+	view_tail();
+	if (fold_pop_segment() || fold_comparison())
+		return true;
+
+	// Value just stored above SP is read back: D still holds it.
+	if ((t = tail(6)) && t[0] == "@SP" && t[1] == "A=M" && t[2] == "M=D" &&
+	    t[3] == "@SP" && t[4] == "A=M" && t[5] == "D=M") {
+		replace(6, { "@SP", "A=M", "M=D" });
+		return true;
+	}
+
+	// Value stored above SP is dead once it went somewhere else.
+	if ((t = tail(5)) && t[0] == "@SP" && t[1] == "A=M" && t[2] == "M=D" &&
+	    a_instruction(t[3]) && t[3] != "@SP" && (t[4] == "M=D" || jump(t[4]))) {
+		replace(5, { t[3], t[4] });
+		return true;
+	}
+
+	// push x; add => x + top of stack
+	if ((t = tail(5)) && t[0] == "@1" && t[1] == "D=A" && t[2] == "@SP" && t[3] == "A=M-1" &&
+	    (t[4] == "M=D+M" || t[4] == "M=M-D")) {
+		replace(5, { "@SP", "A=M-1", t[4] == "M=D+M" ? "M=M+1" : "M=M-1" });
+		return true;
+	}
+
+	// push local 0 and friends
+	if ((t = tail(5)) && constant(t[0]) >= 0 && constant(t[0]) <= 2 && t[1] == "D=A" &&
+	    !segment_base(t[2]).empty() && t[3] == "A=D+M" && t[4] == "D=M") {
+		long index = constant(t[0]);
+		std::string_view base = segment_base(t[2]);
+		truncate(5);
+		address(base, index);
+		append("D=M");
+		return true;
+	}
+
+	// Stack pointer incremented and decremented right away.
+	if ((t = tail(4)) && t[0] == "@SP" && t[1] == "M=M+1" && t[2] == "@SP") {
+		if (t[3] == "M=M-1") {
+			replace(4, {});
+			return true;
+		}
+		if (t[3] == "AM=M-1") {
+			replace(4, { "@SP", "A=M" });
+			return true;
+		}
+		if (t[3] == "A=M-1") {
+			replace(4, { "@SP", "M=M+1", "A=M-1" });
+			return true;
+		}
+	}
+
+	// Redundant @SP reload after a pop.
+	if ((t = tail(4)) && t[0] == "@SP" && t[1] == "M=M-1" && t[2] == "@SP" && t[3] == "A=M") {
+		replace(4, { "@SP", "AM=M-1" });
+		return true;
+	}
+
+	// Dead store above SP followed by a peek at the top of the stack.
+	if ((t = tail(4)) && t[0] == "@SP" && t[1] == "A=M" && t[2] == "M=D" && t[3] == "A=A-1") {
+		replace(4, { "@SP", "A=M-1" });
+		return true;
+	}
+
+	// push temp/pointer/static adds an index of 0 to a register.
+	if ((t = tail(4)) && t[0] == "@0" && t[1] == "D=A" && a_instruction(t[2]) &&
+	    segment_base(t[2]).empty() && t[3] == "D=D+M") {
+		replace(4, { t[2], "D=M" });
+		return true;
+	}
+
+	// An A-instruction immediately overwritten by another one.
+	if ((t = tail(2)) && a_instruction(t[0]) && a_instruction(t[1])) {
+		replace(2, { t[1] });
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * pop local/argument/this/that i computes the address into R13 before
+ * reading the stack:
+ *
+ *   @i, D=A, @SEG, D=D+M, @R13, M=D, @SP, A=M, D=M, @R13, A=M, M=D
+ *
+ * Preceded by a store above SP (what is left of a push) D already holds the
+ * value, otherwise by the SP decrement of the pop itself. Small indexes are
+ * addressed directly from the base pointer.
+ */
+bool peephole::fold_pop_segment()
+{
+	const std::string_view *t = tail(12);
+
+	if (!t || t[1] != "D=A" || segment_base(t[2]).empty() || t[3] != "D=D+M" ||
+	    t[4] != "@R13" || t[5] != "M=D" || t[6] != "@SP" || t[7] != "A=M" ||
+	    t[8] != "D=M" || t[9] != "@R13" || t[10] != "A=M" || t[11] != "M=D")
+		return false;
+
+	long index = constant(t[0]);
+	if (index < 0)
+		return false;
+
+	std::string_view base = segment_base(t[2]);
+	std::size_t direct = 3 + (index > 0 ? index - 1 : 0);
+
+	if ((t = tail(15)) && t[0] == "@SP" && t[1] == "A=M" && t[2] == "M=D") {
+		std::string_view index_line = t[3];
+		if (direct <= 12) {
+			truncate(15);
+			address(base, index);
+			append("M=D");
+		} else
+			replace(15, { "@R14", "M=D", index_line, "D=A", base, "D=D+M", "@R13", "M=D",
+			              "@R14", "D=M", "@R13", "A=M", "M=D" });
+		return true;
+	}
+
+	if ((t = tail(14)) && t[0] == "@SP" && t[1] == "M=M-1") {
+		std::string_view index_line = t[2];
+		if (3 + direct <= 12) {
+			truncate(14);
+			append("@SP");
+			append("AM=M-1");
+			append("D=M");
+			address(base, index);
+			append("M=D");
+		} else
+			replace(14, { index_line, "D=A", base, "D=D+M", "@R13", "M=D",
+			              "@SP", "AM=M-1", "D=M", "@R13", "A=M", "M=D" });
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * eq/gt/lt branch to the true label when the comparison holds and to the
+ * false label otherwise, but the true label is the next instruction:
+ *
+ *   @TRUE, D;JEQ, @FALSE, D;JNE, (TRUE)  =>  @FALSE, D;JNE, (TRUE)
+ */
+bool peephole::fold_comparison()
+{
+	const std::string_view *t = tail(5);
+
+	if (!t || !a_instruction(t[0]) || !a_instruction(t[2]) ||
+	    t[4].size() != t[0].size() + 1 || t[4].front() != '(' || t[4].back() != ')' ||
+	    t[4].substr(1, t[4].size() - 2) != t[0].substr(1))
+		return false;
+
+	const char *taken = complement(t[1]);
+	if (!taken || t[3] != taken)
+		return false;
+
+	replace(5, { t[2], t[3], t[4] });
+	return true;
+}
+
+// Views of as many of the last lines as the longest rule looks at, taken
+// once per round of rules and valid until the output changes.
+void peephole::view_tail()
+{
+	const std::size_t capacity = sizeof(m_tail) / sizeof(m_tail[0]);
+
+	m_tail_size = std::min(m_starts.size(), capacity);
+
+	std::size_t first = m_starts.size() - m_tail_size;
+	std::size_t end = m_text.size();
+	for (std::size_t i = m_tail_size; i-- > 0; ) {
+		std::size_t begin = m_starts[first + i];
+		m_tail[capacity - m_tail_size + i] = std::string_view(m_text.data() + begin, end - begin - 1);
+		end = begin;
+	}
+}
+
+// The last n lines, or null when there are fewer.
+const std::string_view *peephole::tail(std::size_t n) const
+{
+	const std::size_t capacity = sizeof(m_tail) / sizeof(m_tail[0]);
+
+	if (m_tail_size < n)
+		return nullptr;
+	return m_tail + capacity - n;
+}
+
+void peephole::append(std::string_view line)
+{
+	m_starts.push_back(m_text.size());
+	m_text.append(line);
+	m_text.push_back('\n');
+}
+
+// Drops the last n lines.
+void peephole::truncate(std::size_t n)
+{
+	m_text.resize(m_starts[m_starts.size() - n]);
+	m_starts.resize(m_starts.size() - n);
+}
+
+/**
+ * Replaces the last n lines. The new lines may be views of the old ones,
+ * so they are staged in a scratch buffer before the tail is cut off.
+ */
+void peephole::replace(std::size_t n, std::initializer_list<std::string_view> lines)
+{
+	m_scratch.clear();
+	for (std::string_view line : lines)
+		m_scratch.append(line).push_back('\n');
+
+	truncate(n);
+
+	std::size_t begin = m_text.size();
+	m_text.append(m_scratch);
+	for (std::size_t i = 0; i < m_scratch.size(); i++) {
+		if (i == 0 || m_scratch[i - 1] == '\n')
+			m_starts.push_back(begin + i);
+	}
+}
+
+// Points A at base[index] without touching D.
+void peephole::address(std::string_view base, long index)
+{
+	append(base);
+	if (index == 0) {
+		append("A=M");
+		return;
+	}
+	append("A=M+1");
+	for (long i = 1; i < index; i++)
+		append("A=A+1");
+}
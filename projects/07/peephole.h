@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace vm {
+	/**
+	 * Peephole optimizer for the generated Hack assembly.
+	 *
+	 * Every VM command is translated on its own, so a push leaves SP
+	 * incremented just for the next pop or arithmetic command to decrement
+	 * it again. Lines are pushed one at a time and the rewrite rules are
+	 * matched against the tail of the already optimized output until none
+	 * applies, which keeps the pass linear and lets a rewrite expose the
+	 * next one. Labels never match an instruction pattern, so nothing is
+	 * moved across a jump target.
+	 *
+	 * The rules rely on two invariants of the code generator: memory at and
+	 * above SP is dead, and neither A nor D is live between VM commands.
+	 *
+	 * The output is one append-only text buffer with the start of every
+	 * line on the side. Rewrites only ever touch the tail, so they truncate
+	 * the buffer and append, and the finished text is written out as is.
+	 */
+	class peephole {
+	public:
+		explicit peephole(bool enabled);
+
+		// Appends the line made of the given parts.
+		void push(std::initializer_list<std::string_view> parts);
+
+		// The output so far, every line terminated by a newline.
+		const std::string &text() const;
+		std::string release();
+
+		// Number of instructions (labels excluded) before and after the pass.
+		std::size_t emitted() const;
+		std::size_t instructions() const;
+
+	private:
+		bool m_enabled;
+		std::string m_text;
+		std::vector<std::size_t> m_starts;
+		std::size_t m_emitted;
+		std::size_t m_instructions;
+		std::string_view m_tail[15];
+		std::size_t m_tail_size;
+		std::string m_scratch;
+
+		bool fold();
+		bool fold_pop_segment();
+		bool fold_comparison();
+
+		void view_tail();
+		const std::string_view *tail(std::size_t n) const;
+		void append(std::string_view line);
+		void replace(std::size_t n, std::initializer_list<std::string_view> lines);
+		void truncate(std::size_t n);
+		void address(std::string_view base, long index);
+	};
+} // namespace vm
@@ -6,67 +6,302 @@
  *   $ cd $_
  *   $ cmake ..
  *   $ make
+ *
+ * Options:
+ *   -O level    0 writes every VM command as translated, 1 (the default)
+ *               runs the peephole optimizer over the generated assembly,
+ *               2 also folds constants over basic blocks and keeps pushed
+ *               values off the stack until a command needs them there.
+ *   -c mode     eq/gt/lt are expanded inline, call one shared routine per
+ *               comparison (shared), or are shared only when the inline
+ *               program would not fit in the 32K ROM (auto, the default).
+ *   -j threads  translate the files of a directory on this many threads
+ *               (0 or default: one per core). Files are concatenated in
+ *               sorted order whatever the thread count.
+ *   -f format   write Hack assembly (asm, the default), or assemble in
+ *               process into the .hack text (hack) or a packed
+ *               little-endian ROM image (bin), as hacker does.
+ *   -l          with -f hack|bin, also write the .asm listing.
+ *   -r mode     call and return jump to the shared frame routines (shared,
+ *               the default) or save and restore the frame inline (inline).
+ *   -w          whole program: parse every file first and leave out the
+ *               functions not reachable from Sys.init.
+ *   -i size     with -w, inline leaf functions of up to this many commands
+ *               where the cycles saved outweigh the ROM added (0 or
+ *               default: no inlining).
+ *
+ * A directory with a Sys.vm, or any program with -w, starts with the
+ * bootstrap code calling Sys.init.
  */
 
 #include "command_type.h"
-#include "parser.h"
 #include "code.h"
+#include "backend.h"
+#include "module.h"
+#include "inliner.h"
+#include "ir.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
 
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
 
-static void translate_file(const std::string &file_name, std::ostream &os)
+// Instructions that fit in the Hack ROM (ROM32K).
+static const std::size_t rom_size = 32768;
+
+// Assembly text of one translated file, one label or instruction per line,
+// its instruction counts before and after optimization and what whole
+// program mode left out.
+struct file_report {
+	std::string file_name;
+	std::string assembly;
+	std::size_t emitted = 0;
+	std::size_t instructions = 0;
+	unsigned routines = 0;
+	std::size_t functions = 0;
+	std::size_t removed_functions = 0;
+	std::size_t removed_instructions = 0;
+	std::string error;
+};
+
+using modules = std::vector<std::unique_ptr<vm::module>>;
+
+static void write_command(vm::code &c, const vm::command &command)
 {
-	vm::parser p(file_name);
-	vm::code c(file_name, os);
-
-	while (p.has_more_commands()) {
-		p.advance();
-		switch (p.command()) {
-		case vm::command_type::c_push:
-		case vm::command_type::c_pop:
-			c.write_push_pop(p.command(), p.arg1(), p.arg2());
-			break;
-		case vm::command_type::c_arithmetic:
-			c.write_arithmetic(p.arg1());
-			break;
-		case vm::command_type::c_label:
-		case vm::command_type::c_goto:
-		case vm::command_type::c_if:
-			c.write_label_command(p.command(), p.arg1());
-			break;
-		case vm::command_type::none:
-			break;
-		default:
-			std::cerr << "Error: Command (" << static_cast<int>(p.command()) << ") not implemented yet." << std::endl;
+	switch (command.type) {
+	case vm::command_type::c_push:
+	case vm::command_type::c_pop:
+		c.write_push_pop(command.type, command.segment, command.index, command.file);
+		break;
+	case vm::command_type::c_arithmetic:
+		c.write_arithmetic(command.arithmetic);
+		break;
+	case vm::command_type::c_label:
+	case vm::command_type::c_goto:
+	case vm::command_type::c_if:
+		c.write_label_command(command.type, command.name);
+		break;
+	case vm::command_type::c_function:
+		c.write_function(command.name, command.index);
+		break;
+	case vm::command_type::c_call:
+		c.write_call(command.name, command.index);
+		break;
+	case vm::command_type::c_return:
+		c.write_return();
+		break;
+	case vm::command_type::none:
+		break;
+	}
+}
+
+// Unreachable functions are translated on the side, only to be counted.
+static void translate_module(file_report &report, const vm::module &m, const vm::code::options &options)
+{
+	vm::code c(m.file_name(), options);
+	vm::code removed(m.file_name(), options);
+
+	for (const vm::function &f : m.functions()) {
+		if (!f.name.empty())
+			report.functions++;
+		if (!f.reachable)
+			report.removed_functions++;
+
+		for (const vm::command &command : f.commands)
+			write_command(f.reachable ? c : removed, command);
+	}
+
+	report.assembly = c.release();
+	report.emitted = c.emitted();
+	report.instructions = c.instructions();
+	report.routines = c.routines();
+	report.removed_instructions = removed.instructions();
+}
+
+// Runs work(0) .. work(items - 1) on a pool of threads.
+template<typename F>
+static void run(unsigned threads, std::size_t items, F work)
+{
+	std::atomic<std::size_t> next(0);
+	auto worker = [&]() {
+		for (std::size_t i; (i = next++) < items; )
+			work(i);
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned t = 1; t < threads && t < items; t++)
+		pool.emplace_back(worker);
+	worker();
+	for (std::thread &t : pool)
+		t.join();
+}
+
+// Parses every file on the worker threads.
+static modules load(const std::vector<std::string> &files, unsigned threads)
+{
+	modules loaded(files.size());
+	std::vector<std::string> errors(files.size());
+
+	run(threads, files.size(), [&](std::size_t i) {
+		try {
+			loaded[i].reset(new vm::module(files[i]));
+		} catch (const std::exception &e) {
+			errors[i] = e.what();
 		}
+	});
+
+	for (std::size_t i = 0; i < files.size(); i++)
+		if (!errors[i].empty())
+			throw std::runtime_error(files[i] + ": " + errors[i]);
+
+	return loaded;
+}
+
+/**
+ * Translates every module into its own buffer on the worker threads, after
+ * the bootstrap code if asked for and followed by the shared routines they
+ * call. The reports keep the order of files, so the output does not depend
+ * on which thread finished first.
+ */
+static std::vector<file_report> translate(const modules &loaded, const vm::code::options &options,
+                                          unsigned threads, bool bootstrap)
+{
+	std::vector<file_report> reports(loaded.size());
+
+	run(threads, loaded.size(), [&](std::size_t i) {
+		reports[i].file_name = loaded[i]->file_name();
+		try {
+			translate_module(reports[i], *loaded[i], options);
+		} catch (const std::exception &e) {
+			reports[i].error = e.what();
+		}
+	});
+
+	if (bootstrap) {
+		file_report report;
+		vm::code c("bootstrap", options);
+
+		c.write_init();
+		report.file_name = "(bootstrap)";
+		report.assembly = c.release();
+		report.emitted = c.emitted();
+		report.instructions = c.instructions();
+		report.routines = c.routines();
+		reports.insert(reports.begin(), report);
+	}
+
+	unsigned routines = 0;
+	for (const file_report &report : reports) {
+		if (!report.error.empty())
+			throw std::runtime_error(report.file_name + ": " + report.error);
+		routines |= report.routines;
+	}
+
+	if (routines) {
+		file_report report;
+		vm::code c("routines", options);
+
+		c.write_routines(routines);
+		report.file_name = "(shared routines)";
+		report.assembly = c.release();
+		report.emitted = c.emitted();
+		report.instructions = c.instructions();
+		reports.push_back(report);
 	}
+
+	return reports;
+}
+
+static std::size_t instructions(const std::vector<file_report> &reports)
+{
+	std::size_t count = 0;
+	for (const file_report &report : reports)
+		count += report.instructions;
+	return count;
 }
 
 static void abort_with_usage(const char *argv0)
 {
-	std::cerr << "usage: " << argv0 << " [file.vm or dir(with *.vm)]" << std::endl;
+	std::cerr << "usage: " << argv0 << " [-O level] [-c inline|shared|auto] [-j threads] [-f asm|hack|bin] [-l]"
+	          << " [-r inline|shared] [-w] [-i size]"
+	          << " [file.vm or dir(with *.vm)]" << std::endl;
 	std::abort();
 }
 
 int main(int argc, char *argv[])
 {
-	if (argc != 2)
+	vm::code::options options;
+	std::string comparisons("auto");
+	unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+	std::string format("asm");
+	bool listing = false;
+	bool whole_program = false;
+	std::size_t inline_size = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "O:c:j:f:lr:wi:")) != -1) {
+		switch (opt) {
+		case 'O':
+			options.optimize = std::atoi(optarg);
+			break;
+		case 'c':
+			comparisons = optarg;
+			if (comparisons != "inline" && comparisons != "shared" && comparisons != "auto")
+				abort_with_usage(argv[0]);
+			break;
+		case 'j':
+			threads = std::strtoul(optarg, nullptr, 10);
+			if (threads == 0)
+				threads = std::max(std::thread::hardware_concurrency(), 1u);
+			break;
+		case 'f':
+			format = optarg;
+			if (format != "asm" && format != "hack" && format != "bin")
+				abort_with_usage(argv[0]);
+			break;
+		case 'l':
+			listing = true;
+			break;
+		case 'r':
+			if (std::string(optarg) != "inline" && std::string(optarg) != "shared")
+				abort_with_usage(argv[0]);
+			options.shared_calls = std::string(optarg) == "shared";
+			break;
+		case 'w':
+			whole_program = true;
+			break;
+		case 'i':
+			inline_size = std::strtoul(optarg, nullptr, 10);
+			break;
+		default:
+			abort_with_usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1 || (inline_size > 0 && !whole_program))
 		abort_with_usage(argv[0]);
 
-	std::string arg_name(argv[1]);
+	std::string arg_name(argv[optind]);
 	fs::path arg_path(arg_name);
 
 	if (!fs::exists(arg_path))
 		abort_with_usage(argv[0]);
 
 	std::string asm_file_name;
-	std::ofstream ofs;
+	std::vector<std::string> files;
+	bool bootstrap = false;
 
 	if (fs::is_directory(arg_path)) {
 		fs::path dir_path(arg_path);
@@ -75,28 +310,118 @@ int main(int argc, char *argv[])
 		else
 			dir_path /= arg_path.stem();
 		asm_file_name = dir_path.string() + ".asm";
-		ofs.open(asm_file_name, std::ofstream::out);
 		std::for_each(fs::directory_iterator(arg_path), fs::directory_iterator(),
-		              [&ofs](const fs::path &p) {
-			              if (p.extension() == ".vm")
-				              translate_file(p.string(), ofs);
+		              [&files, &bootstrap](const fs::path &p) {
+			              if (p.extension() == ".vm") {
+				              files.push_back(p.string());
+				              bootstrap |= p.stem() == "Sys";
+			              }
 		              });
 	} else if (fs::is_regular_file(arg_path)) {
 		if (arg_path.extension() == ".vm") {
 			std::string file_name(arg_path.string());
 			asm_file_name = file_name.substr(0, file_name.rfind(".")) + ".asm";
-			ofs.open(asm_file_name, std::ofstream::out);
-			translate_file(file_name, ofs);
+			files.push_back(file_name);
 		}
 		else
 			abort_with_usage(argv[0]);
 	} else
 		abort_with_usage(argv[0]);
 
-	ofs.flush();
-	ofs.close();
+	// Output must not depend on the directory iteration order.
+	std::sort(files.begin(), files.end());
+
+	// In auto mode comparisons stay inline unless the program would not fit in ROM.
+	options.shared_comparisons = comparisons == "shared";
+
+	std::vector<file_report> reports;
+
+	try {
+		modules loaded = load(files, threads);
+
+		if (whole_program) {
+			if (!vm::mark_reachable(loaded, "Sys.init"))
+				throw std::runtime_error("whole program mode needs Sys.init");
+			bootstrap = true;
 
-	std::cout << "Writen Hack assembly to: " << asm_file_name << std::endl;
+			if (inline_size > 0) {
+				std::size_t sites = vm::inliner(inline_size, options.shared_calls).run(loaded);
+				std::cout << "Inlined " << sites << " calls." << std::endl;
+				// Functions inlined everywhere are not called any more.
+				vm::mark_reachable(loaded, "Sys.init");
+			}
+		}
+
+		if (options.optimize >= 2) {
+			std::atomic<std::size_t> folded(0);
+			run(threads, loaded.size(), [&](std::size_t i) {
+				for (vm::function &f : loaded[i]->functions())
+					folded += vm::fold_constants(f);
+			});
+			std::cout << "Constant folding removed " << folded << " commands." << std::endl;
+		}
+
+		reports = translate(loaded, options, threads, bootstrap);
+
+		if (comparisons == "auto" && instructions(reports) > rom_size) {
+			std::cout << "Program exceeds " << rom_size << " instructions, using shared comparisons." << std::endl;
+			options.shared_comparisons = true;
+			reports = translate(loaded, options, threads, bootstrap);
+		}
+	} catch (const std::exception &e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	for (const file_report &report : reports) {
+		std::cout << report.file_name << ": " << report.emitted << " -> " << report.instructions << " instructions";
+		if (report.emitted > 0)
+			std::cout << " (-" << std::fixed << std::setprecision(1)
+			          << 100.0 * (report.emitted - report.instructions) / report.emitted << "%)";
+		if (report.removed_functions > 0)
+			std::cout << ", " << report.removed_functions << " unreachable functions removed";
+		std::cout << std::endl;
+	}
+
+	if (whole_program) {
+		std::size_t functions = 0, removed_functions = 0, removed_instructions = 0;
+		for (const file_report &report : reports) {
+			functions += report.functions;
+			removed_functions += report.removed_functions;
+			removed_instructions += report.removed_instructions;
+		}
+		std::cout << "Removed " << removed_functions << " of " << functions << " functions ("
+		          << removed_instructions << " instructions) not reachable from Sys.init." << std::endl;
+	}
+
+	if (instructions(reports) > rom_size)
+		std::cerr << "Warning: " << instructions(reports) << " instructions do not fit in ROM." << std::endl;
+
+	if (format == "asm" || listing) {
+		std::ofstream ofs(asm_file_name, std::ofstream::out);
+		for (const file_report &report : reports)
+			ofs.write(report.assembly.data(), report.assembly.size());
+		ofs.close();
+
+		std::cout << "Writen Hack assembly to: " << asm_file_name << std::endl;
+	}
+
+	if (format != "asm") {
+		std::string hack_file_name(asm_file_name.substr(0, asm_file_name.rfind("."))
+		                           .append(format == "hack" ? ".hack" : ".bin"));
+
+		try {
+			vm::backend b;
+			for (const file_report &report : reports)
+				b.assemble(report.assembly);
+			b.write(hack_file_name, format == "hack" ? hacker::writer::format::hack : hacker::writer::format::binary);
+		} catch (const std::exception &e) {
+			std::cerr << "Error: " << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		std::cout << "Writen binary to: " << hack_file_name << std::endl;
+	}
 
 	return 0;
 }
@@ -0,0 +1,366 @@
+#include "builtins.h"
+#include "reference.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+using namespace hdl;
+
+device::~device() = default;
+
+void device::eval(pins &)
+{
+}
+
+void device::tick(pins &)
+{
+}
+
+void device::tock(pins &)
+{
+}
+
+bool device::read(long, uint16_t &) const
+{
+	return false;
+}
+
+bool device::write(long, uint16_t)
+{
+	return false;
+}
+
+void device::command(const std::string &name, const std::string &)
+{
+	throw std::runtime_error("unknown command " + name);
+}
+
+namespace {
+	// A combinational chip computed by its reference model.
+	class combinational : public device {
+	public:
+		explicit combinational(const reference &r)
+			: m_reference(r)
+		{
+		}
+
+		void eval(pins &p) override
+		{
+			uint16_t in[16], out[16];
+			const std::size_t inputs = m_reference.inputs.size();
+
+			for (std::size_t i = 0; i < inputs; i++)
+				in[i] = p.get(i);
+			m_reference.model(in, out);
+			for (std::size_t i = 0; i < m_reference.outputs.size(); i++)
+				p.set(inputs + i, out[i]);
+		}
+
+	private:
+		const reference &m_reference;
+	};
+
+	// Register, ARegister and DRegister: in[16], load | out[16], and Bit one bit wide.
+	class register16 : public device {
+	public:
+		enum { in, load, out };
+
+		void eval(pins &p) override
+		{
+			p.set(out, m_value);
+		}
+
+		void tick(pins &p) override
+		{
+			m_next = p.get(load) ? p.get(in) : m_value;
+		}
+
+		void tock(pins &p) override
+		{
+			m_value = m_next;
+			eval(p);
+		}
+
+		bool read(long, uint16_t &value) const override
+		{
+			value = m_value;
+			return true;
+		}
+
+		bool write(long, uint16_t value) override
+		{
+			m_value = m_next = value;
+			return true;
+		}
+
+	private:
+		uint16_t m_value = 0;
+		uint16_t m_next = 0;
+	};
+
+	// PC: in[16], load, inc, reset | out[16].
+	class counter : public device {
+	public:
+		enum { in, load, inc, reset, out };
+
+		void eval(pins &p) override
+		{
+			p.set(out, m_value);
+		}
+
+		void tick(pins &p) override
+		{
+			if (p.get(reset))
+				m_next = 0;
+			else if (p.get(load))
+				m_next = p.get(in);
+			else if (p.get(inc))
+				m_next = m_value + 1;
+			else
+				m_next = m_value;
+		}
+
+		void tock(pins &p) override
+		{
+			m_value = m_next;
+			eval(p);
+		}
+
+		bool read(long, uint16_t &value) const override
+		{
+			value = m_value;
+			return true;
+		}
+
+		bool write(long, uint16_t value) override
+		{
+			m_value = m_next = value;
+			return true;
+		}
+
+	private:
+		uint16_t m_value = 0;
+		uint16_t m_next = 0;
+	};
+
+	/**
+	 * RAM8 to RAM16K and Screen: in[16], load, address[n] | out[16].
+	 * Reading is combinational, a write shows on out after the falling
+	 * edge.
+	 */
+	template<std::size_t Words>
+	class memory : public device {
+	public:
+		enum { in, load, address, out };
+
+		memory()
+			: m_words(Words)
+		{
+		}
+
+		void eval(pins &p) override
+		{
+			p.set(out, m_words[p.get(address) % Words]);
+		}
+
+		void tick(pins &p) override
+		{
+			m_store = p.get(load);
+			m_address = p.get(address) % Words;
+			m_value = p.get(in);
+		}
+
+		void tock(pins &p) override
+		{
+			if (m_store)
+				m_words[m_address] = m_value;
+			m_store = false;
+			eval(p);
+		}
+
+		bool read(long index, uint16_t &value) const override
+		{
+			if (index < 0 || static_cast<std::size_t>(index) >= Words)
+				return false;
+			value = m_words[index];
+			return true;
+		}
+
+		bool write(long index, uint16_t value) override
+		{
+			if (index < 0 || static_cast<std::size_t>(index) >= Words)
+				return false;
+			m_words[index] = value;
+			return true;
+		}
+
+	private:
+		std::vector<uint16_t> m_words;
+		bool m_store = false;
+		std::size_t m_address = 0;
+		uint16_t m_value = 0;
+	};
+
+	// Keyboard: | out[16], the key set by the script as Keyboard[].
+	class keyboard : public device {
+	public:
+		enum { out };
+
+		void eval(pins &p) override
+		{
+			p.set(out, m_key);
+		}
+
+		bool read(long, uint16_t &value) const override
+		{
+			value = m_key;
+			return true;
+		}
+
+		bool write(long, uint16_t value) override
+		{
+			m_key = value;
+			return true;
+		}
+
+	private:
+		uint16_t m_key = 0;
+	};
+
+	// ROM32K: address[15] | out[16], loaded from a .hack file by the script.
+	class rom : public device {
+	public:
+		enum { address, out };
+
+		rom()
+			: m_words(0x8000)
+		{
+		}
+
+		void eval(pins &p) override
+		{
+			p.set(out, m_words[p.get(address) & 0x7FFF]);
+		}
+
+		bool read(long index, uint16_t &value) const override
+		{
+			if (index < 0 || index >= 0x8000)
+				return false;
+			value = m_words[index];
+			return true;
+		}
+
+		bool write(long index, uint16_t value) override
+		{
+			if (index < 0 || index >= 0x8000)
+				return false;
+			m_words[index] = value;
+			return true;
+		}
+
+		void command(const std::string &name, const std::string &argument) override
+		{
+			if (name != "load")
+				device::command(name, argument);
+
+			std::ifstream ifs(argument);
+			if (!ifs)
+				throw std::runtime_error("cannot open " + argument);
+
+			std::fill(m_words.begin(), m_words.end(), 0);
+
+			std::string line;
+			std::size_t count = 0;
+			while (std::getline(ifs, line)) {
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				if (line.empty())
+					continue;
+				if (line.size() != 16 || line.find_first_not_of("01") != std::string::npos || count == 0x8000)
+					throw std::runtime_error(argument + ": line " + std::to_string(count + 1) + " is not a Hack instruction");
+				m_words[count++] = std::stoul(line, nullptr, 2);
+			}
+		}
+
+	private:
+		std::vector<uint16_t> m_words;
+	};
+
+	template<typename T>
+	std::unique_ptr<device> make()
+	{
+		return std::unique_ptr<device>(new T());
+	}
+
+	builtin define(const std::string &name, std::vector<pin> inputs, std::vector<pin> outputs,
+	               std::vector<std::string> clocked, std::function<std::unique_ptr<device>()> make)
+	{
+		builtin b;
+		b.interface.name = name;
+		b.interface.file = "(builtin)";
+		b.interface.inputs = std::move(inputs);
+		b.interface.outputs = std::move(outputs);
+		b.interface.builtin = name;
+		b.interface.clocked = std::move(clocked);
+		b.make = std::move(make);
+		return b;
+	}
+
+	builtin define(const reference &r)
+	{
+		return define(r.chip, r.inputs, r.outputs, {}, [&r]() {
+			return std::unique_ptr<device>(new combinational(r));
+		});
+	}
+
+	std::vector<builtin> table()
+	{
+		std::vector<builtin> table = {
+			define("Nand", { { "a", 1 }, { "b", 1 } }, { { "out", 1 } }, {}, nullptr),
+			define("DFF", { { "in", 1 } }, { { "out", 1 } }, { "in" }, nullptr),
+			define("Register", { { "in", 16 }, { "load", 1 } }, { { "out", 16 } },
+			       { "in", "load" }, make<register16>),
+			define("ARegister", { { "in", 16 }, { "load", 1 } }, { { "out", 16 } },
+			       { "in", "load" }, make<register16>),
+			define("DRegister", { { "in", 16 }, { "load", 1 } }, { { "out", 16 } },
+			       { "in", "load" }, make<register16>),
+			define("PC", { { "in", 16 }, { "load", 1 }, { "inc", 1 }, { "reset", 1 } }, { { "out", 16 } },
+			       { "in", "load", "inc", "reset" }, make<counter>),
+			define("Bit", { { "in", 1 }, { "load", 1 } }, { { "out", 1 } },
+			       { "in", "load" }, make<register16>),
+			define("RAM8", { { "in", 16 }, { "load", 1 }, { "address", 3 } }, { { "out", 16 } },
+			       { "in", "load" }, make<memory<8>>),
+			define("RAM64", { { "in", 16 }, { "load", 1 }, { "address", 6 } }, { { "out", 16 } },
+			       { "in", "load" }, make<memory<64>>),
+			define("RAM512", { { "in", 16 }, { "load", 1 }, { "address", 9 } }, { { "out", 16 } },
+			       { "in", "load" }, make<memory<512>>),
+			define("RAM4K", { { "in", 16 }, { "load", 1 }, { "address", 12 } }, { { "out", 16 } },
+			       { "in", "load" }, make<memory<0x1000>>),
+			define("RAM16K", { { "in", 16 }, { "load", 1 }, { "address", 14 } }, { { "out", 16 } },
+			       { "in", "load" }, make<memory<0x4000>>),
+			define("Screen", { { "in", 16 }, { "load", 1 }, { "address", 13 } }, { { "out", 16 } },
+			       { "in", "load" }, make<memory<0x2000>>),
+			define("Keyboard", {}, { { "out", 16 } }, {}, make<keyboard>),
+			define("ROM32K", { { "address", 15 } }, { { "out", 16 } }, {}, make<rom>),
+		};
+		for (const reference &r : references())
+			table.push_back(define(r));
+		return table;
+	}
+
+	const std::vector<builtin> &builtins()
+	{
+		static const std::vector<builtin> builtins = table();
+		return builtins;
+	}
+} // namespace
+
+const builtin *hdl::find_builtin(const std::string &name)
+{
+	for (const builtin &b : builtins())
+		if (b.interface.name == name)
+			return &b;
+	return nullptr;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "chip.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace hdl {
+	/**
+	 * The pins of a builtin part as its simulator sees them, numbered
+	 * inputs first and then outputs, in declaration order.
+	 */
+	class pins {
+	public:
+		virtual uint16_t get(std::size_t pin) const = 0;
+		virtual void set(std::size_t pin, uint16_t value) = 0;
+
+	protected:
+		~pins() = default;
+	};
+
+	/**
+	 * Native implementation of a builtin chip. eval() computes the outputs
+	 * from the inputs that are not clocked, tick() samples the inputs on
+	 * the rising clock edge and tock() commits the new state to the
+	 * outputs on the falling one.
+	 *
+	 * Registers and memories expose their words to test scripts as
+	 * Chip[index], or Chip[] (index -1) for a single register.
+	 */
+	class device {
+	public:
+		virtual ~device();
+
+		virtual void eval(pins &p);
+		virtual void tick(pins &p);
+		virtual void tock(pins &p);
+
+		// False when there is no such word.
+		virtual bool read(long index, uint16_t &value) const;
+		virtual bool write(long index, uint16_t value);
+
+		// A script command addressed to the part, like "ROM32K load Max.hack".
+		virtual void command(const std::string &name, const std::string &argument);
+	};
+
+	struct builtin {
+		chip interface;
+		// Empty for Nand and DFF, which every simulator implements itself.
+		std::function<std::unique_ptr<device>()> make;
+	};
+
+	/**
+	 * The builtin chip of that name, or null. Besides the Nand and DFF
+	 * primitives these are the chips the projects use without an .hdl of
+	 * their own (ARegister, DRegister, Screen, Keyboard and ROM32K) and
+	 * behavioral models of the chips of projects 01 to 03: the
+	 * combinational ones run their reference model, Bit, Register and PC
+	 * hold a word, and the RAMs an array. A model stands in for a chip
+	 * without an .hdl, or for any part when the library is asked to.
+	 */
+	const builtin *find_builtin(const std::string &name);
+} // namespace hdl
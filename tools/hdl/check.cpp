@@ -0,0 +1,180 @@
+#include "check.h"
+#include "lanes.h"
+#include "pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+
+using namespace hdl;
+
+namespace {
+	// The wires of the chip pins in the order of the model's.
+	std::vector<const bus *> match(const netlist &n, const std::vector<pin> &model, const std::vector<pin> &pins)
+	{
+		std::vector<const bus *> buses;
+
+		for (const pin &m : model) {
+			bool found = false;
+			for (const pin &p : pins)
+				found |= p.name == m.name && p.width == m.width;
+			if (!found)
+				throw std::runtime_error("chip " + n.top->name + " has no pin " + m.name + "[" +
+				                         std::to_string(m.width) + "] like its reference model");
+			buses.push_back(&n.signals.at(m.name));
+		}
+		if (pins.size() != model.size())
+			throw std::runtime_error("chip " + n.top->name + " has other pins than its reference model");
+
+		return buses;
+	}
+
+	std::string describe(const std::vector<pin> &pins, const uint16_t *values)
+	{
+		std::string text;
+		for (std::size_t i = 0; i < pins.size(); i++)
+			text += (i ? " " : "") + pins[i].name + "=" + std::to_string(values[i]);
+		return text;
+	}
+
+	// Bit b of values[0], values[stride], ... as the first lanes of a word.
+	lane_word pack(const uint16_t *values, std::size_t stride, unsigned b, std::size_t lanes)
+	{
+		lane_word word = lane_word();
+		for (std::size_t lane = 0; lane < lanes; lane++)
+			word.bits[lane / 64] |= uint64_t(values[lane * stride] >> b & 1) << (lane % 64);
+		return word;
+	}
+
+	// Vectors per work item of the pool, a multiple of lane_word::lanes.
+	constexpr uint64_t block_vectors = uint64_t(1) << 16;
+
+	// What one block of vectors found.
+	struct block_result {
+		uint64_t mismatches = 0;
+		std::string first_mismatch;
+		std::chrono::duration<double> evaluating{ 0 };
+	};
+
+	/**
+	 * Checks count vectors from first on, exhaustive ones or random ones
+	 * drawn from a generator seeded with the block, so that the vectors
+	 * do not depend on the number of threads.
+	 */
+	block_result check_block(lanes sim, const reference &r, const std::vector<const bus *> &inputs,
+	                         const std::vector<const bus *> &outputs, uint64_t first, uint64_t count,
+	                         bool exhaustive)
+	{
+		using clock = std::chrono::steady_clock;
+
+		const std::size_t lane_count = lane_word::lanes;
+		const std::size_t in_count = inputs.size(), out_count = outputs.size();
+
+		block_result result;
+		std::mt19937_64 random(first / block_vectors + 1);
+		std::vector<uint16_t> in(lane_count * in_count), expected(lane_count * out_count);
+
+		for (uint64_t base = first; base < first + count; base += lane_count) {
+			const std::size_t used = std::min<uint64_t>(lane_count, first + count - base);
+
+			// The inputs of every lane, then the same bit of all lanes per wire.
+			for (std::size_t lane = 0; lane < used; lane++) {
+				uint64_t v = base + lane;
+				for (std::size_t k = 0; k < in_count; k++) {
+					const unsigned width = r.inputs[k].width;
+					const uint16_t mask = (1u << width) - 1;
+					if (exhaustive) {
+						in[lane * in_count + k] = v & mask;
+						v >>= width;
+					} else
+						in[lane * in_count + k] = random() & mask;
+				}
+			}
+			for (std::size_t k = 0; k < in_count; k++)
+				for (std::size_t b = 0; b < inputs[k]->size(); b++)
+					sim[(*inputs[k])[b]] = pack(&in[k], in_count, b, used);
+
+			const auto eval_start = clock::now();
+			sim.eval();
+			result.evaluating += clock::now() - eval_start;
+
+			for (std::size_t lane = 0; lane < used; lane++)
+				r.model(&in[lane * in_count], &expected[lane * out_count]);
+
+			lane_word wrong = lane_word();
+			for (std::size_t k = 0; k < out_count; k++)
+				for (std::size_t b = 0; b < outputs[k]->size(); b++) {
+					lane_word want = pack(&expected[k], out_count, b, used);
+					wrong.bits |= want.bits ^ sim[(*outputs[k])[b]].bits;
+				}
+
+			for (std::size_t lane = 0; lane < used; lane++) {
+				if (!wrong.test(lane))
+					continue;
+
+				if (result.mismatches++ == 0) {
+					std::vector<uint16_t> got(out_count);
+					for (std::size_t k = 0; k < out_count; k++)
+						for (std::size_t b = 0; b < outputs[k]->size(); b++)
+							got[k] |= sim[(*outputs[k])[b]].test(lane) << b;
+					for (std::size_t k = 0; k < out_count; k++)
+						expected[lane * out_count + k] &= (1u << r.outputs[k].width) - 1;
+
+					result.first_mismatch = describe(r.inputs, &in[lane * in_count]) + ": " +
+					                        describe(r.outputs, got.data()) + ", expected " +
+					                        describe(r.outputs, &expected[lane * out_count]);
+				}
+			}
+		}
+
+		return result;
+	}
+} // namespace
+
+/**
+ * Splits the vectors into blocks that the threads take in turn, each
+ * evaluating its block on its own copy of the sorted gates. The blocks
+ * are merged in order, so the first mismatch is the same for any number
+ * of threads.
+ */
+check_result hdl::check(const netlist &n, const reference &r, uint64_t max_vectors, unsigned threads)
+{
+	using clock = std::chrono::steady_clock;
+
+	const auto start = clock::now();
+	const std::vector<const bus *> inputs = match(n, r.inputs, n.top->inputs);
+	const std::vector<const bus *> outputs = match(n, r.outputs, n.top->outputs);
+
+	unsigned input_bits = 0;
+	for (const pin &p : r.inputs)
+		input_bits += p.width;
+
+	check_result result = check_result();
+	result.exhaustive = input_bits < 64 && uint64_t(1) << input_bits <= max_vectors;
+	result.vectors = result.exhaustive ? uint64_t(1) << input_bits : max_vectors;
+
+	const lanes sorted(n);
+	const std::size_t blocks = (result.vectors + block_vectors - 1) / block_vectors;
+	std::vector<block_result> found(blocks);
+
+	run_parallel(threads, blocks, [&](std::size_t i) {
+		const uint64_t first = i * block_vectors;
+		found[i] = check_block(sorted, r, inputs, outputs, first,
+		                       std::min(block_vectors, result.vectors - first), result.exhaustive);
+	});
+
+	std::chrono::duration<double> evaluating(0);
+	for (const block_result &b : found) {
+		if (result.mismatches == 0)
+			result.first_mismatch = b.first_mismatch;
+		result.mismatches += b.mismatches;
+		evaluating += b.evaluating;
+	}
+
+	result.gate_evaluations = sorted.gates() * result.vectors;
+	result.eval_seconds = evaluating.count();
+	result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+	return result;
+}
+
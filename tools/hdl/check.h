@@ -0,0 +1,30 @@
+#pragma once
+
+#include "netlist.h"
+#include "reference.h"
+
+#include <cstdint>
+#include <string>
+
+namespace hdl {
+	struct check_result {
+		uint64_t vectors;
+		bool exhaustive;
+		uint64_t mismatches;
+		// Inputs and outputs of the first vector that did not match.
+		std::string first_mismatch;
+		// Time spent in the gates by all threads, and in the whole check.
+		double eval_seconds;
+		double seconds;
+		uint64_t gate_evaluations;
+	};
+
+	/**
+	 * Runs a combinational chip and its reference model side by side on
+	 * every input vector if there are at most max_vectors of them, or on
+	 * max_vectors random ones otherwise, lane_word::lanes at a time on
+	 * each of the threads. Throws std::runtime_error if the pins of the
+	 * chip differ from those of the model.
+	 */
+	check_result check(const netlist &n, const reference &r, uint64_t max_vectors, unsigned threads);
+} // namespace hdl
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace hdl {
+	// An input or output pin of a chip, width bits wide.
+	struct pin {
+		std::string name;
+		unsigned width;
+	};
+
+	/**
+	 * One pin=signal connection of a part, e.g. sel[0..1]=address[13..14].
+	 * A missing sub-bus is the whole pin or signal (lo = -1). The signal is
+	 * a pin of the enclosing chip, one of its internal buses, or the
+	 * constant true or false.
+	 */
+	struct connection {
+		std::string pin;
+		int pin_lo, pin_hi;
+		std::string signal;
+		int signal_lo, signal_hi;
+		std::size_t line;
+	};
+
+	struct part {
+		std::string chip;
+		std::vector<connection> connections;
+		std::size_t line;
+	};
+
+	/**
+	 * A chip as declared in its .hdl file. Builtin chips have no parts but
+	 * the name of their native implementation, and list the inputs that
+	 * only matter when the clock ticks (CLOCKED), so that they never feed
+	 * the outputs combinationally.
+	 */
+	struct chip {
+		std::string name;
+		std::string file;
+		std::vector<pin> inputs;
+		std::vector<pin> outputs;
+		std::vector<part> parts;
+		std::string builtin;
+		std::vector<std::string> clocked;
+	};
+} // namespace hdl
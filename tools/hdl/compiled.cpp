@@ -0,0 +1,103 @@
+#include "compiled.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include <dlfcn.h>
+
+namespace fs = boost::filesystem;
+
+using namespace hdl;
+
+namespace {
+	// Gates per function, which keeps the compiler from choking on big chips.
+	constexpr std::size_t chunk = 4096;
+
+	void emit(std::ostream &out, uint32_t first_gate, const std::vector<uint32_t> &a,
+	          const std::vector<uint32_t> &b, const std::vector<part_step> &steps)
+	{
+		out << "#include <cstdint>\n\n"
+		    << "typedef void (*part_callback)(void *context, uint32_t part);\n\n";
+
+		for (std::size_t begin = 0; begin < a.size(); begin += chunk) {
+			out << "static void gates" << begin / chunk << "(uint8_t *v)\n{\n";
+			for (std::size_t i = begin; i < a.size() && i < begin + chunk; i++)
+				out << "\tv[" << first_gate + i << "] = !(v[" << a[i] << "] & v[" << b[i] << "]);\n";
+			out << "}\n\n";
+		}
+
+		// The gates between two parts, cut where the functions end.
+		auto gates = [&](std::size_t begin, std::size_t end) {
+			while (begin < end) {
+				std::size_t stop = std::min(end, (begin / chunk + 1) * chunk);
+				if (begin % chunk == 0 && stop % chunk == 0)
+					out << "\tgates" << begin / chunk << "(v);\n";
+				else
+					for (std::size_t i = begin; i < stop; i++)
+						out << "\tv[" << first_gate + i << "] = !(v[" << a[i] << "] & v[" << b[i] << "]);\n";
+				begin = stop;
+			}
+		};
+
+		out << "extern \"C\" void hdl_sweep(uint8_t *v, part_callback part, void *context)\n{\n";
+		std::size_t done = 0;
+		for (const part_step &s : steps) {
+			gates(done, s.end);
+			out << "\tpart(context, " << s.part << ");\n";
+			done = s.end;
+		}
+		gates(done, a.size());
+		out << "}\n";
+	}
+} // namespace
+
+compiled_sweep::compiled_sweep(uint32_t first_gate, const std::vector<uint32_t> &a,
+                               const std::vector<uint32_t> &b, const std::vector<part_step> &steps)
+{
+	const fs::path dir = fs::temp_directory_path() / fs::unique_path("hdl-%%%%-%%%%-%%%%");
+	const fs::path source = dir / "sweep.cpp";
+	const fs::path library = dir / "sweep.so";
+	fs::create_directory(dir);
+
+	{
+		std::ofstream out(source.string());
+		emit(out, first_gate, a, b, steps);
+		if (!out)
+			throw std::runtime_error("cannot write " + source.string());
+	}
+
+	const char *cxx = std::getenv("CXX");
+	const std::string command = std::string(cxx ? cxx : "c++") + " -O1 -shared -fPIC -o '" + library.string() +
+	                            "' '" + source.string() + "'";
+	if (std::system(command.c_str()) != 0) {
+		fs::remove_all(dir);
+		throw std::runtime_error("compiling the netlist failed: " + command);
+	}
+
+	// The library stays mapped after its file is gone.
+	m_library = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+	fs::remove_all(dir);
+	if (!m_library)
+		throw std::runtime_error(std::string("cannot load the compiled netlist: ") + dlerror());
+
+	m_sweep = reinterpret_cast<decltype(m_sweep)>(dlsym(m_library, "hdl_sweep"));
+	if (!m_sweep) {
+		dlclose(m_library);
+		throw std::runtime_error("the compiled netlist has no hdl_sweep");
+	}
+}
+
+compiled_sweep::~compiled_sweep()
+{
+	dlclose(m_library);
+}
+
+void compiled_sweep::run(uint8_t *values, part_callback part, void *context) const
+{
+	m_sweep(values, part, context);
+}
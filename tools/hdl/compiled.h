@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace hdl {
+	// After the gates before end, builtin part number part is evaluated.
+	struct part_step {
+		std::size_t end;
+		uint32_t part;
+	};
+
+	/**
+	 * A levelized sweep emitted as straight-line C++, one statement per
+	 * gate with the slots as constants, compiled into a shared library by
+	 * $CXX (c++ if unset) and loaded. Builtin parts are evaluated through
+	 * a callback. Throws std::runtime_error if compiling or loading fails.
+	 */
+	class compiled_sweep {
+	public:
+		using part_callback = void (*)(void *context, uint32_t part);
+
+		compiled_sweep(uint32_t first_gate, const std::vector<uint32_t> &a, const std::vector<uint32_t> &b,
+		               const std::vector<part_step> &steps);
+		~compiled_sweep();
+
+		compiled_sweep(const compiled_sweep &) = delete;
+		compiled_sweep &operator=(const compiled_sweep &) = delete;
+
+		void run(uint8_t *values, part_callback part, void *context) const;
+
+	private:
+		void *m_library;
+		void (*m_sweep)(uint8_t *values, part_callback part, void *context);
+	};
+} // namespace hdl
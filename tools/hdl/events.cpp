@@ -0,0 +1,208 @@
+#include "events.h"
+
+#include <stdexcept>
+
+using namespace hdl;
+
+/**
+ * The pins of one builtin part, read and written through the wires of
+ * the simulator, so that outputs a part sets reach their readers.
+ */
+class event_simulator::part_pins : public pins {
+public:
+	part_pins(event_simulator &sim, builtin_part &part)
+		: m_sim(sim),
+		  m_part(part)
+	{
+	}
+
+	uint16_t get(std::size_t pin) const override
+	{
+		return m_sim.get(m_part.pins[pin]);
+	}
+
+	void set(std::size_t pin, uint16_t value) override
+	{
+		const bus &b = m_part.pins[pin];
+		for (std::size_t i = 0; i < b.size(); i++)
+			m_sim.drive(b[i], value >> i & 1);
+	}
+
+private:
+	event_simulator &m_sim;
+	builtin_part &m_part;
+};
+
+event_simulator::event_simulator(netlist &n)
+	: m_netlist(n),
+	  m_values(n.wires, 0),
+	  m_first(n.wires + 1, 0),
+	  m_evaluations(0)
+{
+	const uint32_t nands = n.nands.size();
+	const uint32_t dffs = n.dffs.size();
+	const uint32_t readers = nands + dffs + n.parts.size();
+
+	m_values[wire_true] = 1;
+	m_queued.assign(readers, 0);
+	m_is_pending.assign(dffs, 0);
+	m_next.assign(dffs, 0);
+
+	// Count the readers of every wire, then fill them in.
+	auto each_read = [&](auto visit) {
+		for (uint32_t i = 0; i < nands; i++) {
+			visit(n.nands[i].a, i);
+			if (n.nands[i].b != n.nands[i].a)
+				visit(n.nands[i].b, i);
+		}
+		for (uint32_t i = 0; i < dffs; i++)
+			visit(n.dffs[i].in, nands + i);
+		for (uint32_t i = 0; i < n.parts.size(); i++)
+			for (std::size_t pin = 0; pin < n.parts[i].clocked.size(); pin++)
+				if (!n.parts[i].clocked[pin])
+					for (wire w : n.parts[i].pins[pin])
+						visit(w, nands + dffs + i);
+	};
+
+	each_read([&](wire w, uint32_t) { m_first[w + 1]++; });
+	for (std::size_t w = 0; w < n.wires; w++)
+		m_first[w + 1] += m_first[w];
+
+	std::vector<uint32_t> fill(m_first.begin(), m_first.end() - 1);
+	m_readers.resize(m_first.back());
+	each_read([&](wire w, uint32_t reader) { m_readers[fill[w]++] = reader; });
+
+	// Nothing has settled yet: every gate and part is evaluated once, and
+	// every DFF takes its input on the first clock.
+	for (uint32_t reader = 0; reader < readers; reader++)
+		if (reader < nands || reader >= nands + dffs)
+			schedule(reader);
+	for (uint32_t i = 0; i < dffs; i++) {
+		m_pending.push_back(i);
+		m_is_pending[i] = 1;
+	}
+	eval();
+}
+
+netlist &event_simulator::circuit()
+{
+	return m_netlist;
+}
+
+uint16_t event_simulator::get(const bus &b) const
+{
+	uint16_t value = 0;
+	for (std::size_t i = 0; i < b.size(); i++)
+		value |= m_values[b[i]] << i;
+	return value;
+}
+
+void event_simulator::set(const bus &b, uint16_t value)
+{
+	for (std::size_t i = 0; i < b.size(); i++)
+		drive(b[i], value >> i & 1);
+}
+
+void event_simulator::drive(wire w, uint8_t value)
+{
+	if (m_values[w] == value)
+		return;
+
+	m_values[w] = value;
+	for (uint32_t i = m_first[w]; i < m_first[w + 1]; i++)
+		schedule(m_readers[i]);
+}
+
+void event_simulator::schedule(uint32_t reader)
+{
+	const uint32_t nands = m_netlist.nands.size();
+
+	if (reader >= nands && reader < nands + m_netlist.dffs.size()) {
+		uint32_t i = reader - nands;
+		if (!m_is_pending[i]) {
+			m_is_pending[i] = 1;
+			m_pending.push_back(i);
+		}
+		return;
+	}
+
+	if (!m_queued[reader]) {
+		m_queued[reader] = 1;
+		m_queue.push_back(reader);
+	}
+}
+
+void event_simulator::evaluate_part(builtin_part &p)
+{
+	part_pins pins(*this, p);
+	p.model->eval(pins);
+}
+
+/**
+ * Evaluates the scheduled gates in the order they were scheduled until
+ * none is left. A circuit that keeps changing after many times its size
+ * in evaluations has a loop without a DFF.
+ */
+void event_simulator::eval()
+{
+	const uint32_t nands = m_netlist.nands.size();
+	const uint32_t first_part = nands + m_netlist.dffs.size();
+	const uint64_t limit = m_evaluations + 1000 * (uint64_t(m_queued.size()) + 1);
+
+	for (std::size_t head = 0; head < m_queue.size(); head++) {
+		const uint32_t reader = m_queue[head];
+		m_queued[reader] = 0;
+
+		if (reader < nands) {
+			const nand_gate &g = m_netlist.nands[reader];
+			drive(g.out, !(m_values[g.a] & m_values[g.b]));
+		} else
+			evaluate_part(m_netlist.parts[reader - first_part]);
+
+		if (++m_evaluations > limit)
+			throw std::runtime_error("chip " + m_netlist.top->name + " does not settle, is there a loop without a DFF?");
+	}
+	m_queue.clear();
+}
+
+void event_simulator::tick()
+{
+	eval();
+
+	for (uint32_t i : m_pending) {
+		m_next[i] = m_values[m_netlist.dffs[i].in];
+		m_is_pending[i] = 0;
+	}
+	m_latched.swap(m_pending);
+	m_pending.clear();
+
+	for (builtin_part &p : m_netlist.parts) {
+		part_pins pins(*this, p);
+		p.model->tick(pins);
+	}
+}
+
+void event_simulator::tock()
+{
+	for (uint32_t i : m_latched)
+		drive(m_netlist.dffs[i].out, m_next[i]);
+	m_latched.clear();
+
+	for (builtin_part &p : m_netlist.parts) {
+		part_pins pins(*this, p);
+		p.model->tock(pins);
+	}
+
+	eval();
+}
+
+void event_simulator::refresh(builtin_part &p)
+{
+	evaluate_part(p);
+	eval();
+}
+
+uint64_t event_simulator::evaluations() const
+{
+	return m_evaluations;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "simulator.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace hdl {
+	/**
+	 * Event-driven simulation of a netlist. Setting a wire to a new value
+	 * schedules the gates and builtin parts reading it, and eval() works
+	 * through the schedule until nothing changes, so the cost of a step is
+	 * proportional to the activity rather than to the size of the chip.
+	 * Only the DFFs whose input changed since the last edge are visited.
+	 */
+	class event_simulator : public simulator {
+	public:
+		explicit event_simulator(netlist &n);
+
+		netlist &circuit() override;
+
+		uint16_t get(const bus &b) const override;
+		void set(const bus &b, uint16_t value) override;
+
+		void eval() override;
+		void tick() override;
+		void tock() override;
+
+		void refresh(builtin_part &p) override;
+
+		uint64_t evaluations() const override;
+
+	private:
+		class part_pins;
+
+		netlist &m_netlist;
+		std::vector<uint8_t> m_values;
+		// Readers of wire w are m_readers[m_first[w]] .. m_readers[m_first[w + 1] - 1],
+		// Nand gates first, then DFFs, then builtin parts.
+		std::vector<uint32_t> m_first;
+		std::vector<uint32_t> m_readers;
+		std::vector<uint32_t> m_queue;
+		std::vector<uint8_t> m_queued;
+		// DFFs whose input changed since the last tick, and those latched by it.
+		std::vector<uint32_t> m_pending;
+		std::vector<uint8_t> m_is_pending;
+		std::vector<uint32_t> m_latched;
+		std::vector<uint8_t> m_next;
+		uint64_t m_evaluations;
+
+		void drive(wire w, uint8_t value);
+		void schedule(uint32_t reader);
+		void evaluate_part(builtin_part &p);
+	};
+} // namespace hdl
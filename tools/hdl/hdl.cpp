@@ -0,0 +1,300 @@
+/**
+ * Hardware simulator for the HDL chips of projects 01 to 05
+ *
+ * To compile:
+ *   $ mkdir build
+ *   $ cd $_
+ *   $ cmake ..
+ *   $ make
+ *
+ * Usage:
+ *   hdl [-I dir]... [-j threads] [-s] [-e engine] [-m] [-E] [-g chip]... file.tst|file.hdl...
+ *   hdl [-I dir]... [-j threads] -x [-n vectors] file.hdl...
+ *
+ * A .tst script is run the way the hardware simulator of the book runs
+ * it, comparing its output with the compare file as it goes. For an
+ * .hdl file the flattened chip is only described, or with -x checked
+ * against a reference model written in C++.
+ *
+ * Given several files, hdl runs the scripts on a pool of threads, each
+ * with a netlist of its own, and checks the chips one at a time with the
+ * vectors split across the threads. The reports come out in the order of
+ * the files, followed by a table of the time each took.
+ *
+ * Options:
+ *   -I dir   look for the parts of a chip in dir too, after the directory
+ *            of the chip itself. Chips found nowhere are builtin.
+ *   -j count run on count threads (default: one per core).
+ *   -s       print statistics: clock cycles, gate evaluations, elapsed
+ *            time and cycles per second.
+ *   -e name  simulate with this engine: sweep (the default) evaluates
+ *            every gate once per step in a precomputed order, compiled
+ *            does the same in C++ compiled for the chip with $CXX, and
+ *            events only the gates whose inputs changed.
+ *   -m       simulate the parts of the loaded chip by the behavioral models
+ *            of their chips where there are any: the chips of projects 01
+ *            and 02 by their reference models, Bit, Register and PC as a
+ *            word and the RAMs as arrays.
+ *   -g chip  with -m or -E, simulate chip and everything inside it gate
+ *            by gate anyway, e.g. the part under test.
+ *   -E       run the script at gate level, then again with -m, and check
+ *            that both produce the same output.
+ *   -x       check a combinational chip of projects 01 and 02 against its
+ *            reference model, evaluating 256 input vectors at once.
+ *   -n count check every input vector if there are at most count of them,
+ *            else count random ones (default: 16777216).
+ */
+
+#include "check.h"
+#include "library.h"
+#include "netlist.h"
+#include "pool.h"
+#include "reference.h"
+#include "script.h"
+#include "simulator.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+namespace {
+	struct settings {
+		std::vector<std::string> path;
+		bool statistics = false;
+		hdl::engine engine = hdl::engine::sweep;
+		hdl::model_policy models;
+		bool equivalence = false;
+		bool check = false;
+		uint64_t vectors = uint64_t(1) << 24;
+		unsigned threads = hdl::default_threads();
+	};
+
+	// How one file went, for the table printed after several of them.
+	struct outcome {
+		bool passed = false;
+		// Clock cycles of a script, or vectors of a check.
+		uint64_t work = 0;
+		double seconds = 0;
+	};
+} // namespace
+
+static void abort_with_usage(const char *argv0)
+{
+	std::cerr << "usage: " << argv0 << " [-I dir]... [-j threads] [-s] [-e engine] [-m] [-E] [-g chip]... "
+	          << "[-x [-n vectors]] file.tst|file.hdl..." << std::endl;
+	std::abort();
+}
+
+static bool run_script(hdl::script &s, bool statistics, std::ostream &out, outcome &o)
+{
+	auto start = std::chrono::steady_clock::now();
+	bool passed = s.run(out);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	if (statistics) {
+		out << "Cycles: " << s.cycles() << ", evaluations: " << s.evaluations()
+		    << ", elapsed: " << elapsed.count() << " s";
+		if (elapsed.count() > 0)
+			out << ", " << static_cast<uint64_t>(s.cycles() / elapsed.count()) << " cycles/s";
+		out << std::endl;
+	}
+
+	o.work += s.cycles();
+	o.seconds += elapsed.count();
+	return passed;
+}
+
+static bool check_chip(const hdl::netlist &n, const settings &set, std::ostream &out, outcome &o)
+{
+	const hdl::reference *r = hdl::find_reference(n.top->name);
+	if (!r)
+		throw std::runtime_error("no reference model for chip " + n.top->name);
+
+	hdl::check_result result = hdl::check(n, *r, set.vectors, set.threads);
+
+	out << n.top->name << ": " << result.vectors << (result.exhaustive ? " vectors (all)" : " random vectors");
+	if (result.mismatches == 0)
+		out << ", all match the reference model" << std::endl;
+	else
+		out << ", " << result.mismatches << " do not match the reference model, first "
+		    << result.first_mismatch << std::endl;
+
+	out << n.nands.size() << " Nand gates, " << std::setprecision(3) << result.eval_seconds
+	    << " s evaluating (" << result.seconds << " s in all)";
+	if (result.eval_seconds > 0)
+		out << ", " << result.gate_evaluations / result.eval_seconds << " gate evaluations/s";
+	out << std::endl;
+
+	o.work = result.vectors;
+	o.seconds = result.seconds;
+	return result.mismatches == 0;
+}
+
+// Runs, checks or describes one file, writing what it finds to out.
+static outcome run_file(const std::string &file, settings set, std::ostream &out)
+{
+	std::string extension = file.substr(file.rfind('.') == std::string::npos ? file.size() : file.rfind('.'));
+	outcome o;
+
+	if (extension == ".hdl") {
+		hdl::library lib(set.path, set.models);
+		hdl::netlist n = hdl::flatten(lib, lib.load(file));
+
+		if (set.check) {
+			o.passed = check_chip(n, set, out, o);
+			return o;
+		}
+
+		out << n.top->name << ": " << n.nands.size() << " Nand gates, " << n.dffs.size() << " DFFs, "
+		    << n.parts.size() << " builtin parts, " << n.wires << " wires" << std::endl;
+		for (const hdl::builtin_part &p : n.parts)
+			out << "  builtin " << p.spec->name << std::endl;
+		o.passed = true;
+		return o;
+	}
+	if (extension != ".tst" || set.check)
+		throw std::runtime_error(file + " is not a .tst script" + (set.check ? "" : " or an .hdl chip"));
+
+	if (!set.equivalence) {
+		hdl::script s(file, set.path, set.engine, set.models);
+		o.passed = run_script(s, set.statistics, out, o);
+		return o;
+	}
+
+	// The gate-level output becomes the compare file of the mixed run.
+	hdl::script gates(file, set.path, set.engine);
+	gates.keep_output();
+	out << "Gate level:" << std::endl;
+	if (!run_script(gates, set.statistics, out, o))
+		return o;
+
+	set.models.enabled = true;
+	hdl::script mixed(file, set.path, set.engine, set.models);
+	mixed.compare_to(gates.output_lines());
+	out << "Behavioral models:" << std::endl;
+	o.passed = run_script(mixed, set.statistics, out, o);
+	return o;
+}
+
+/**
+ * Several files. Checks split their vectors across the threads, so they
+ * run one after the other; scripts are sequential, so the threads take
+ * one script each. The reports are printed in the order of the files,
+ * then a table of the time each took.
+ */
+static int run_files(const std::vector<std::string> &files, settings set)
+{
+	std::vector<outcome> outcomes(files.size());
+	std::vector<std::string> reports(files.size());
+
+	auto run = [&](std::size_t i) {
+		std::ostringstream out;
+		try {
+			outcomes[i] = run_file(files[i], set, out);
+		} catch (const std::exception &e) {
+			out << "Error: " << e.what() << std::endl;
+		}
+		reports[i] = out.str();
+	};
+
+	const unsigned threads = set.threads;
+	const auto start = std::chrono::steady_clock::now();
+	if (set.check) {
+		for (std::size_t i = 0; i < files.size(); i++)
+			run(i);
+	} else {
+		set.threads = 1;
+		hdl::run_parallel(threads, files.size(), run);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::size_t failed = 0;
+	for (std::size_t i = 0; i < files.size(); i++) {
+		std::cout << files[i] << ":" << std::endl << reports[i];
+		failed += !outcomes[i].passed;
+	}
+
+	std::cout << std::endl << std::left << std::setw(20) << "Chip" << std::right << std::setw(8) << "Result"
+	          << std::setw(16) << (set.check ? "Vectors" : "Cycles") << std::setw(12) << "Seconds" << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+	for (std::size_t i = 0; i < files.size(); i++)
+		std::cout << std::left << std::setw(20) << boost::filesystem::path(files[i]).stem().string() << std::right
+		          << std::setw(8) << (outcomes[i].passed ? "ok" : "FAILED") << std::setw(16) << outcomes[i].work
+		          << std::setw(12) << outcomes[i].seconds << std::endl;
+	std::cout << files.size() - failed << " of " << files.size() << " passed in " << elapsed.count() << " s on "
+	          << threads << (threads == 1 ? " thread" : " threads") << std::endl;
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+	settings set;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "I:j:se:mg:Exn:")) != -1) {
+		switch (opt) {
+		case 'I':
+			set.path.push_back(optarg);
+			break;
+		case 'j':
+			set.threads = std::strtoul(optarg, nullptr, 10);
+			if (set.threads == 0)
+				set.threads = hdl::default_threads();
+			break;
+		case 's':
+			set.statistics = true;
+			break;
+		case 'e':
+			try {
+				set.engine = hdl::parse_engine(optarg);
+			} catch (const std::exception &e) {
+				std::cerr << "Error: " << e.what() << std::endl;
+				abort_with_usage(argv[0]);
+			}
+			break;
+		case 'm':
+			set.models.enabled = true;
+			break;
+		case 'g':
+			set.models.gate_level.insert(optarg);
+			break;
+		case 'E':
+			set.equivalence = true;
+			break;
+		case 'x':
+			set.check = true;
+			break;
+		case 'n':
+			set.vectors = std::strtoull(optarg, nullptr, 10);
+			if (set.vectors == 0)
+				abort_with_usage(argv[0]);
+			break;
+		default:
+			abort_with_usage(argv[0]);
+		}
+	}
+
+	if (optind == argc || (set.check && (set.models.enabled || set.equivalence)))
+		abort_with_usage(argv[0]);
+
+	std::vector<std::string> files(argv + optind, argv + argc);
+	if (files.size() > 1)
+		return run_files(files, set);
+
+	try {
+		return run_file(files[0], set, std::cout).passed ? EXIT_SUCCESS : EXIT_FAILURE;
+	} catch (const std::exception &e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
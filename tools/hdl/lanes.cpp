@@ -0,0 +1,74 @@
+#include "lanes.h"
+
+#include <stdexcept>
+
+using namespace hdl;
+
+/**
+ * Orders the gates by Kahn's algorithm: a gate is ready once the gates
+ * driving its inputs are placed, and inputs and constants are ready from
+ * the start.
+ */
+lanes::lanes(const netlist &n)
+	: m_values(n.wires)
+{
+	if (!n.dffs.empty() || !n.parts.empty())
+		throw std::runtime_error("chip " + n.top->name + " is not made of Nand gates only");
+
+	const std::size_t none = n.nands.size();
+	std::vector<std::size_t> driver(n.wires, none);
+	for (std::size_t i = 0; i < n.nands.size(); i++)
+		driver[n.nands[i].out] = i;
+
+	// Gates waiting for each gate, and how many inputs each still waits for.
+	std::vector<std::vector<std::size_t>> waiting(n.nands.size());
+	std::vector<unsigned> missing(n.nands.size(), 0);
+	std::vector<std::size_t> ready;
+
+	for (std::size_t i = 0; i < n.nands.size(); i++) {
+		const nand_gate &g = n.nands[i];
+		const wire inputs[] = { g.a, g.b };
+		for (std::size_t k = 0; k < (g.a == g.b ? 1 : 2); k++) {
+			if (driver[inputs[k]] != none) {
+				waiting[driver[inputs[k]]].push_back(i);
+				missing[i]++;
+			}
+		}
+		if (missing[i] == 0)
+			ready.push_back(i);
+	}
+
+	m_order.reserve(n.nands.size());
+	while (!ready.empty()) {
+		std::size_t i = ready.back();
+		ready.pop_back();
+		m_order.push_back(n.nands[i]);
+		for (std::size_t next : waiting[i])
+			if (--missing[next] == 0)
+				ready.push_back(next);
+	}
+
+	if (m_order.size() != n.nands.size())
+		throw std::runtime_error("chip " + n.top->name + " has a loop without a DFF");
+
+	for (lane_word &v : m_values)
+		v.bits = lane_word::words{};
+	m_values[wire_true].bits = ~lane_word::words{};
+}
+
+lane_word &lanes::operator[](wire w)
+{
+	return m_values[w];
+}
+
+void lanes::eval()
+{
+	lane_word *v = m_values.data();
+	for (const nand_gate &g : m_order)
+		v[g.out].bits = ~(v[g.a].bits & v[g.b].bits);
+}
+
+std::size_t lanes::gates() const
+{
+	return m_order.size();
+}
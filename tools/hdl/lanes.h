@@ -0,0 +1,53 @@
+#pragma once
+
+#include "netlist.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace hdl {
+	/**
+	 * One bit of 256 independent test vectors, vector i in bit i % 64 of
+	 * word i / 64. The GCC vector type lets a Nand of all of them compile
+	 * to a single AVX2 instruction, or a few SSE2 ones without it.
+	 */
+	struct lane_word {
+		typedef uint64_t words __attribute__((vector_size(32)));
+
+		static constexpr std::size_t lanes = 256;
+
+		words bits;
+
+		bool test(std::size_t lane) const
+		{
+			return bits[lane / 64] >> (lane % 64) & 1;
+		}
+
+		void set(std::size_t lane)
+		{
+			bits[lane / 64] |= uint64_t(1) << (lane % 64);
+		}
+	};
+
+	/**
+	 * Bit-parallel evaluation of a combinational netlist: every wire holds
+	 * a lane_word, and the Nand gates, sorted so that each comes after the
+	 * gates driving its inputs, are evaluated once per eval() for all the
+	 * vectors at the same time. Throws std::runtime_error if the netlist
+	 * has DFFs, builtin parts or a loop.
+	 */
+	class lanes {
+	public:
+		explicit lanes(const netlist &n);
+
+		lane_word &operator[](wire w);
+		void eval();
+
+		std::size_t gates() const;
+
+	private:
+		std::vector<nand_gate> m_order;
+		std::vector<lane_word> m_values;
+	};
+} // namespace hdl
@@ -0,0 +1,86 @@
+#include "library.h"
+#include "builtins.h"
+#include "parser.h"
+
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+using namespace hdl;
+
+library::library(std::vector<std::string> path, model_policy models)
+	: m_path(std::move(path)),
+	  m_models(std::move(models))
+{
+}
+
+const chip &library::load(const std::string &file)
+{
+	fs::path dir = fs::path(file).parent_path();
+	m_path.insert(m_path.begin(), dir.empty() ? "." : dir.string());
+
+	chip c = parse_hdl(file);
+	if (fs::path(file).stem() != c.name)
+		throw std::runtime_error(file + ": chip " + c.name + " does not match the file name");
+
+	auto found = m_chips.find(c.name);
+	if (found != m_chips.end())
+		return *found->second;
+	return add(std::move(c));
+}
+
+const chip &library::find(const std::string &name)
+{
+	auto found = m_chips.find(name);
+	if (found != m_chips.end())
+		return *found->second;
+
+	for (const std::string &dir : m_path) {
+		fs::path file = fs::path(dir) / (name + ".hdl");
+		if (fs::is_regular_file(file))
+			return add(parse_hdl(file.string()));
+	}
+
+	const builtin *b = find_builtin(name);
+	if (!b)
+		throw std::runtime_error("chip " + name + " not found");
+	m_chips[name] = &b->interface;
+	return b->interface;
+}
+
+const chip &library::find(const std::string &name, bool models)
+{
+	if (models && m_models.gate_level.count(name) == 0) {
+		const builtin *b = find_builtin(name);
+		if (b && b->make)
+			return b->interface;
+	}
+	return find(name);
+}
+
+bool library::models_inside(const chip &c) const
+{
+	return m_models.enabled && m_models.gate_level.count(c.name) == 0;
+}
+
+// A chip declared BUILTIN in its .hdl stands for the native one.
+const chip &library::add(chip c)
+{
+	const std::string name = c.name;
+	const chip *added;
+
+	if (!c.builtin.empty()) {
+		const builtin *b = find_builtin(c.builtin);
+		if (!b)
+			throw std::runtime_error(c.file + ": no builtin chip " + c.builtin);
+		added = &b->interface;
+	} else {
+		m_parsed.push_back(std::move(c));
+		added = &m_parsed.back();
+	}
+
+	m_chips[name] = added;
+	return *added;
+}
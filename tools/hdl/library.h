@@ -0,0 +1,52 @@
+#pragma once
+
+#include "chip.h"
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace hdl {
+	/**
+	 * Which parts are simulated by the behavioral model of their chip (see
+	 * find_builtin) rather than by its .hdl. When enabled, every part that
+	 * has one is, except the chips in gate_level and all parts inside them.
+	 * The chip under test is always simulated from its .hdl.
+	 */
+	struct model_policy {
+		bool enabled = false;
+		std::set<std::string> gate_level;
+	};
+
+	/**
+	 * Finds the chips a design is made of, like the hardware simulator of
+	 * the book: a part is read from Name.hdl in the first directory of the
+	 * search path that has one, and is builtin only when none does. Every
+	 * chip is parsed once.
+	 */
+	class library {
+	public:
+		explicit library(std::vector<std::string> path, model_policy models = model_policy());
+
+		// Reads a chip from the given file, searching its directory first.
+		const chip &load(const std::string &file);
+
+		// Throws std::runtime_error if there is no such chip.
+		const chip &find(const std::string &name);
+		// With models, the behavioral model of the chip if it has one.
+		const chip &find(const std::string &name, bool models);
+
+		// Whether the parts of c may be behavioral models.
+		bool models_inside(const chip &c) const;
+
+	private:
+		std::vector<std::string> m_path;
+		model_policy m_models;
+		std::map<std::string, const chip *> m_chips;
+		std::deque<chip> m_parsed;
+
+		const chip &add(chip c);
+	};
+} // namespace hdl
@@ -0,0 +1,390 @@
+#include "netlist.h"
+#include "library.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+using namespace hdl;
+
+builtin_part *netlist::find_part(const std::string &chip)
+{
+	for (builtin_part &p : parts)
+		if (p.spec->name == chip)
+			return &p;
+	return nullptr;
+}
+
+namespace {
+	constexpr wire unconnected = ~wire(0);
+
+	// Sources of a link that are not bits of a net.
+	constexpr long source_false = -1;
+	constexpr long source_true = -2;
+
+	// Bits [pin_bit, pin_bit + width) of a part connected to a net or constant.
+	struct link {
+		std::size_t pin_bit;
+		long source;
+		unsigned width;
+	};
+
+	struct part_layout {
+		const chip *spec;
+		std::size_t input_bits;
+		std::size_t bits;
+		std::vector<link> links;
+	};
+
+	struct net {
+		std::size_t offset;
+		unsigned width;
+	};
+
+	/**
+	 * The connections of a chip resolved once, however often it is used:
+	 * its inputs, outputs and internal buses are laid out as one array of
+	 * bits, and every pin bit of a part refers to one of them.
+	 */
+	struct layout {
+		std::size_t io_bits;
+		std::size_t bits;
+		std::map<std::string, net> nets;
+		std::vector<part_layout> parts;
+	};
+
+	// Where a pin is within the bits of its part.
+	struct pin_position {
+		std::size_t offset;
+		unsigned width;
+		bool output;
+	};
+
+	bool find_pin(const chip &c, const std::string &name, pin_position &position)
+	{
+		std::size_t offset = 0;
+
+		for (const pin &p : c.inputs) {
+			if (p.name == name) {
+				position = pin_position{ offset, p.width, false };
+				return true;
+			}
+			offset += p.width;
+		}
+		for (const pin &p : c.outputs) {
+			if (p.name == name) {
+				position = pin_position{ offset, p.width, true };
+				return true;
+			}
+			offset += p.width;
+		}
+		return false;
+	}
+
+	std::size_t bits(const std::vector<pin> &pins)
+	{
+		std::size_t count = 0;
+		for (const pin &p : pins)
+			count += p.width;
+		return count;
+	}
+
+	class flattener {
+	public:
+		flattener(library &lib, netlist &n)
+			: m_library(lib),
+			  m_netlist(n),
+			  m_parent{ wire_false, wire_true }
+		{
+		}
+
+		void run(const chip &top);
+
+	private:
+		library &m_library;
+		netlist &m_netlist;
+		// Union-find forest over the wires; a root is the smallest wire
+		// of its set, so the constants stay 0 and 1.
+		std::vector<wire> m_parent;
+		// Layouts of chips whose parts are resolved with and without models.
+		std::map<std::pair<const chip *, bool>, layout> m_layouts;
+
+		wire make()
+		{
+			m_parent.push_back(m_parent.size());
+			return m_parent.back();
+		}
+
+		wire find(wire w)
+		{
+			while (m_parent[w] != w)
+				w = m_parent[w] = m_parent[m_parent[w]];
+			return w;
+		}
+
+		void join(wire a, wire b)
+		{
+			a = find(a);
+			b = find(b);
+			if (a < b)
+				m_parent[b] = a;
+			else
+				m_parent[a] = b;
+		}
+
+		const layout &layout_of(const chip &c, bool models);
+		std::vector<wire> instantiate(const chip &c, const wire *io, unsigned depth, bool models);
+		void add_builtin(const chip &c, const wire *io);
+		void renumber();
+	};
+
+	[[noreturn]] void fail(const chip &c, std::size_t line, const std::string &message)
+	{
+		throw std::runtime_error(c.file + ":" + std::to_string(line) + ": " + message);
+	}
+} // namespace
+
+const layout &flattener::layout_of(const chip &c, bool models)
+{
+	auto found = m_layouts.find(std::make_pair(&c, models));
+	if (found != m_layouts.end())
+		return found->second;
+
+	layout l;
+	std::size_t offset = 0;
+
+	for (const std::vector<pin> *pins : { &c.inputs, &c.outputs })
+		for (const pin &p : *pins) {
+			l.nets[p.name] = net{ offset, p.width };
+			offset += p.width;
+		}
+	l.io_bits = offset;
+
+	for (const part &p : c.parts) {
+		part_layout pl;
+		pl.spec = &m_library.find(p.chip, models);
+		pl.input_bits = bits(pl.spec->inputs);
+		pl.bits = pl.input_bits + bits(pl.spec->outputs);
+		l.parts.push_back(pl);
+	}
+
+	// Internal buses take their width from the part output driving them.
+	std::vector<bool> driven(offset, false);
+	for (std::size_t i = 0; i < c.parts.size(); i++) {
+		for (const connection &conn : c.parts[i].connections) {
+			pin_position pin = pin_position();
+			if (!find_pin(*l.parts[i].spec, conn.pin, pin))
+				fail(c, conn.line, "chip " + l.parts[i].spec->name + " has no pin " + conn.pin);
+			if (!pin.output)
+				continue;
+
+			if (conn.signal == "true" || conn.signal == "false")
+				fail(c, conn.line, "output pin " + conn.pin + " connected to a constant");
+
+			auto n = l.nets.find(conn.signal);
+			if (n != l.nets.end() && n->second.offset < l.io_bits) {
+				if (n->second.offset < bits(c.inputs))
+					fail(c, conn.line, "output pin " + conn.pin + " drives input pin " + conn.signal);
+				int lo = conn.signal_lo < 0 ? 0 : conn.signal_lo;
+				int hi = conn.signal_lo < 0 ? n->second.width - 1 : conn.signal_hi;
+				for (int b = lo; b <= hi && b < static_cast<int>(n->second.width); b++) {
+					if (driven[n->second.offset + b])
+						fail(c, conn.line, "output pin " + conn.signal + " has more than one source");
+					driven[n->second.offset + b] = true;
+				}
+				continue;
+			}
+
+			if (conn.signal_lo >= 0)
+				fail(c, conn.line, "sub bus of internal pin " + conn.signal + " may not be used");
+			if (n != l.nets.end())
+				fail(c, conn.line, "internal pin " + conn.signal + " has more than one source");
+
+			unsigned width = conn.pin_lo < 0 ? pin.width : conn.pin_hi - conn.pin_lo + 1;
+			l.nets[conn.signal] = net{ offset, width };
+			offset += width;
+		}
+	}
+	l.bits = offset;
+
+	for (std::size_t i = 0; i < c.parts.size(); i++) {
+		part_layout &pl = l.parts[i];
+		std::vector<bool> connected(pl.input_bits, false);
+
+		for (const connection &conn : c.parts[i].connections) {
+			pin_position pin = pin_position();
+			find_pin(*pl.spec, conn.pin, pin);
+
+			int pin_lo = conn.pin_lo < 0 ? 0 : conn.pin_lo;
+			int pin_hi = conn.pin_lo < 0 ? pin.width - 1 : conn.pin_hi;
+			if (pin_hi >= static_cast<int>(pin.width))
+				fail(c, conn.line, "pin " + conn.pin + " of " + pl.spec->name + " has only " +
+				     std::to_string(pin.width) + " bits");
+			unsigned width = pin_hi - pin_lo + 1;
+
+			link k{ pin.offset + pin_lo, 0, width };
+
+			if (conn.signal == "true" || conn.signal == "false") {
+				k.source = conn.signal == "true" ? source_true : source_false;
+			} else {
+				auto n = l.nets.find(conn.signal);
+				if (n == l.nets.end())
+					fail(c, conn.line, "signal " + conn.signal + " is not an input, output or part output");
+
+				int lo = conn.signal_lo < 0 ? 0 : conn.signal_lo;
+				int hi = conn.signal_lo < 0 ? n->second.width - 1 : conn.signal_hi;
+				if (hi >= static_cast<int>(n->second.width))
+					fail(c, conn.line, "signal " + conn.signal + " has only " +
+					     std::to_string(n->second.width) + " bits");
+				if (static_cast<unsigned>(hi - lo + 1) != width)
+					fail(c, conn.line, "width of " + conn.pin + " (" + std::to_string(width) + ") differs from " +
+					     conn.signal + " (" + std::to_string(hi - lo + 1) + ")");
+				k.source = n->second.offset + lo;
+			}
+
+			if (!pin.output)
+				for (std::size_t b = k.pin_bit; b < k.pin_bit + width; b++) {
+					if (connected[b])
+						fail(c, conn.line, "input pin " + conn.pin + " connected more than once");
+					connected[b] = true;
+				}
+
+			pl.links.push_back(k);
+		}
+	}
+
+	return m_layouts.emplace(std::make_pair(&c, models), std::move(l)).first->second;
+}
+
+/**
+ * Wires up one use of chip c whose inputs and outputs are the io wires,
+ * and returns the wires of all its nets. With models, parts that have a
+ * behavioral model are simulated by it.
+ */
+std::vector<wire> flattener::instantiate(const chip &c, const wire *io, unsigned depth, bool models)
+{
+	if (!c.builtin.empty()) {
+		add_builtin(c, io);
+		return std::vector<wire>();
+	}
+	if (depth > 100)
+		throw std::runtime_error("chip " + c.name + " is nested too deeply, is it a part of itself?");
+
+	const layout &l = layout_of(c, models);
+	std::vector<wire> nets(io, io + l.io_bits);
+	while (nets.size() < l.bits)
+		nets.push_back(make());
+
+	std::vector<wire> pins;
+	for (const part_layout &p : l.parts) {
+		pins.assign(p.bits, unconnected);
+
+		for (const link &k : p.links)
+			for (unsigned b = 0; b < k.width; b++) {
+				wire source = k.source == source_true ? wire_true :
+				              k.source == source_false ? wire_false : nets[k.source + b];
+				wire &slot = pins[k.pin_bit + b];
+				if (slot == unconnected)
+					slot = source;
+				else
+					join(slot, source);
+			}
+
+		for (std::size_t b = 0; b < p.bits; b++)
+			if (pins[b] == unconnected)
+				pins[b] = b < p.input_bits ? wire_false : make();
+
+		instantiate(*p.spec, pins.data(), depth + 1, models && m_library.models_inside(*p.spec));
+	}
+
+	return nets;
+}
+
+void flattener::add_builtin(const chip &c, const wire *io)
+{
+	if (c.builtin == "Nand") {
+		m_netlist.nands.push_back(nand_gate{ io[0], io[1], io[2] });
+		return;
+	}
+	if (c.builtin == "DFF") {
+		m_netlist.dffs.push_back(dff{ io[0], io[1] });
+		return;
+	}
+
+	const builtin *b = find_builtin(c.builtin);
+	builtin_part p;
+
+	p.spec = &c;
+	for (const std::vector<pin> *pins : { &c.inputs, &c.outputs })
+		for (const pin &pin : *pins) {
+			p.pins.push_back(bus(io, io + pin.width));
+			io += pin.width;
+		}
+	for (const pin &pin : c.inputs)
+		p.clocked.push_back(std::find(c.clocked.begin(), c.clocked.end(), pin.name) != c.clocked.end());
+	p.model = b->make();
+
+	m_netlist.parts.push_back(std::move(p));
+}
+
+// Numbers the roots of the wire sets densely, in order.
+void flattener::renumber()
+{
+	std::vector<wire> number(m_parent.size());
+	wire count = 0;
+
+	for (wire w = 0; w < m_parent.size(); w++)
+		number[w] = find(w) == w ? count++ : number[find(w)];
+
+	for (nand_gate &g : m_netlist.nands) {
+		g.a = number[g.a];
+		g.b = number[g.b];
+		g.out = number[g.out];
+	}
+	for (dff &d : m_netlist.dffs) {
+		d.in = number[d.in];
+		d.out = number[d.out];
+	}
+	for (builtin_part &p : m_netlist.parts)
+		for (bus &pin : p.pins)
+			for (wire &w : pin)
+				w = number[w];
+	for (auto &signal : m_netlist.signals)
+		for (wire &w : signal.second)
+			w = number[w];
+
+	m_netlist.wires = count;
+}
+
+void flattener::run(const chip &top)
+{
+	std::vector<wire> io;
+	for (std::size_t b = 0; b < bits(top.inputs) + bits(top.outputs); b++)
+		io.push_back(make());
+
+	const bool models = m_library.models_inside(top);
+	std::vector<wire> nets = instantiate(top, io.data(), 0, models);
+
+	m_netlist.top = &top;
+	if (!top.builtin.empty()) {
+		std::size_t offset = 0;
+		for (const std::vector<pin> *pins : { &top.inputs, &top.outputs })
+			for (const pin &p : *pins) {
+				m_netlist.signals[p.name] = bus(io.begin() + offset, io.begin() + offset + p.width);
+				offset += p.width;
+			}
+	} else {
+		for (const auto &n : layout_of(top, models).nets)
+			m_netlist.signals[n.first] = bus(nets.begin() + n.second.offset,
+			                                 nets.begin() + n.second.offset + n.second.width);
+	}
+
+	renumber();
+}
+
+netlist hdl::flatten(library &lib, const chip &top)
+{
+	netlist n;
+	flattener(lib, n).run(top);
+	return n;
+}
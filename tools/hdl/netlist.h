@@ -0,0 +1,69 @@
+#pragma once
+
+#include "builtins.h"
+#include "chip.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hdl {
+	class library;
+
+	using wire = uint32_t;
+
+	// Wires 0 and 1 always carry false and true.
+	constexpr wire wire_false = 0;
+	constexpr wire wire_true = 1;
+
+	// The wires of a pin or bus, least significant bit first.
+	using bus = std::vector<wire>;
+
+	struct nand_gate {
+		wire a, b, out;
+	};
+
+	struct dff {
+		wire in, out;
+	};
+
+	// A builtin part other than Nand and DFF.
+	struct builtin_part {
+		const chip *spec;
+		// Inputs, then outputs.
+		std::vector<bus> pins;
+		// Per input pin, whether it only matters on the clock edge.
+		std::vector<bool> clocked;
+		std::unique_ptr<device> model;
+	};
+
+	/**
+	 * A chip flattened down to Nand gates, DFFs and builtin parts sharing
+	 * numbered one-bit wires. Every pin=signal connection in the hierarchy
+	 * merges the wires on both sides, so what is left is one wire per
+	 * electrical node, whatever the names it had in the .hdl files.
+	 * Unconnected input pins read false.
+	 */
+	struct netlist {
+		const chip *top = nullptr;
+		std::size_t wires = 2;
+		std::vector<nand_gate> nands;
+		std::vector<dff> dffs;
+		std::vector<builtin_part> parts;
+		// Pins and internal buses of the top chip.
+		std::map<std::string, bus> signals;
+
+		// The first builtin part of the given chip, or null.
+		builtin_part *find_part(const std::string &chip);
+	};
+
+	/**
+	 * Resolves the parts of top through the library, as behavioral models
+	 * where its model_policy says so, and flattens them.
+	 * Throws std::runtime_error naming the .hdl file and line of a bad
+	 * connection.
+	 */
+	netlist flatten(library &lib, const chip &top);
+} // namespace hdl
@@ -0,0 +1,252 @@
+#include "parser.h"
+
+#include <cctype>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+
+using namespace hdl;
+
+namespace {
+	enum class token_type { end, name, number, symbol };
+
+	/**
+	 * Splits HDL source into names, numbers and punctuation, skipping
+	 * comments. ".." is one symbol, every other symbol a single character.
+	 */
+	class lexer {
+	public:
+		lexer(const std::string &file, const std::string &source)
+			: m_file(file),
+			  m_pos(source.data()),
+			  m_end(source.data() + source.size()),
+			  m_line(1)
+		{
+			advance();
+		}
+
+		token_type type() const
+		{
+			return m_type;
+		}
+
+		std::string_view text() const
+		{
+			return m_text;
+		}
+
+		std::size_t line() const
+		{
+			return m_line;
+		}
+
+		bool is(std::string_view text) const
+		{
+			return m_type != token_type::end && m_text == text;
+		}
+
+		void advance()
+		{
+			skip_blanks();
+
+			const char *begin = m_pos;
+			if (m_pos == m_end) {
+				m_type = token_type::end;
+				m_text = std::string_view();
+				return;
+			}
+
+			if (std::isalpha(static_cast<unsigned char>(*m_pos)) || *m_pos == '_') {
+				while (m_pos < m_end && (std::isalnum(static_cast<unsigned char>(*m_pos)) || *m_pos == '_'))
+					m_pos++;
+				m_type = token_type::name;
+			} else if (std::isdigit(static_cast<unsigned char>(*m_pos))) {
+				while (m_pos < m_end && std::isdigit(static_cast<unsigned char>(*m_pos)))
+					m_pos++;
+				m_type = token_type::number;
+			} else {
+				m_pos += m_pos + 1 < m_end && m_pos[0] == '.' && m_pos[1] == '.' ? 2 : 1;
+				m_type = token_type::symbol;
+			}
+			m_text = std::string_view(begin, m_pos - begin);
+		}
+
+		// Consumes the given symbol or keyword, or fails.
+		void expect(std::string_view text)
+		{
+			if (!is(text))
+				fail("expected '" + std::string(text) + "'");
+			advance();
+		}
+
+		std::string name()
+		{
+			if (m_type != token_type::name)
+				fail("expected a name");
+			std::string name(m_text);
+			advance();
+			return name;
+		}
+
+		int number()
+		{
+			if (m_type != token_type::number || m_text.size() > 4)
+				fail("expected a number");
+			int value = std::stoi(std::string(m_text));
+			advance();
+			return value;
+		}
+
+		[[noreturn]] void fail(const std::string &message) const
+		{
+			std::string found = m_type == token_type::end ? "end of file" : "'" + std::string(m_text) + "'";
+			throw std::runtime_error(m_file + ":" + std::to_string(m_line) + ": " + message + ", found " + found);
+		}
+
+	private:
+		const std::string &m_file;
+		const char *m_pos;
+		const char *m_end;
+		std::size_t m_line;
+		token_type m_type;
+		std::string_view m_text;
+
+		void skip_blanks()
+		{
+			while (m_pos < m_end) {
+				if (*m_pos == '\n') {
+					m_line++;
+					m_pos++;
+				} else if (std::isspace(static_cast<unsigned char>(*m_pos))) {
+					m_pos++;
+				} else if (m_pos + 1 < m_end && m_pos[0] == '/' && m_pos[1] == '/') {
+					while (m_pos < m_end && *m_pos != '\n')
+						m_pos++;
+				} else if (m_pos + 1 < m_end && m_pos[0] == '/' && m_pos[1] == '*') {
+					m_pos += 2;
+					while (m_pos < m_end && !(m_pos + 1 < m_end && m_pos[0] == '*' && m_pos[1] == '/')) {
+						if (*m_pos == '\n')
+							m_line++;
+						m_pos++;
+					}
+					m_pos = m_pos < m_end ? m_pos + 2 : m_end;
+				} else
+					break;
+			}
+		}
+	};
+
+	// name or name[width], up to the semicolon.
+	std::vector<pin> parse_pins(lexer &lex)
+	{
+		std::vector<pin> pins;
+
+		for (;;) {
+			pin p{ lex.name(), 1 };
+			if (lex.is("[")) {
+				lex.advance();
+				int width = lex.number();
+				if (width < 1 || width > 16)
+					lex.fail("pin width must be between 1 and 16");
+				p.width = width;
+				lex.expect("]");
+			}
+			pins.push_back(p);
+			if (!lex.is(","))
+				break;
+			lex.advance();
+		}
+
+		lex.expect(";");
+		return pins;
+	}
+
+	// An optional [i] or [i..j] after a pin or signal name.
+	void parse_subbus(lexer &lex, int &lo, int &hi)
+	{
+		lo = hi = -1;
+		if (!lex.is("["))
+			return;
+
+		lex.advance();
+		lo = hi = lex.number();
+		if (lex.is("..")) {
+			lex.advance();
+			hi = lex.number();
+		}
+		if (hi < lo)
+			lex.fail("sub-bus range is reversed");
+		lex.expect("]");
+	}
+
+	part parse_part(lexer &lex)
+	{
+		part p;
+
+		p.line = lex.line();
+		p.chip = lex.name();
+		lex.expect("(");
+		for (;;) {
+			connection c;
+			c.line = lex.line();
+			c.pin = lex.name();
+			parse_subbus(lex, c.pin_lo, c.pin_hi);
+			lex.expect("=");
+			c.signal = lex.name();
+			parse_subbus(lex, c.signal_lo, c.signal_hi);
+			p.connections.push_back(c);
+			if (!lex.is(","))
+				break;
+			lex.advance();
+		}
+		lex.expect(")");
+		lex.expect(";");
+
+		return p;
+	}
+} // namespace
+
+chip hdl::parse_hdl(const std::string &file)
+{
+	std::ifstream ifs(file, std::ifstream::in | std::ifstream::binary);
+	if (!ifs)
+		throw std::runtime_error("cannot open " + file);
+
+	std::string source((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	lexer lex(file, source);
+	chip c;
+
+	c.file = file;
+	lex.expect("CHIP");
+	c.name = lex.name();
+	lex.expect("{");
+
+	if (lex.is("IN")) {
+		lex.advance();
+		c.inputs = parse_pins(lex);
+	}
+	if (lex.is("OUT")) {
+		lex.advance();
+		c.outputs = parse_pins(lex);
+	}
+
+	if (lex.is("BUILTIN")) {
+		lex.advance();
+		c.builtin = lex.name();
+		lex.expect(";");
+		if (lex.is("CLOCKED")) {
+			lex.advance();
+			for (const pin &p : parse_pins(lex))
+				c.clocked.push_back(p.name);
+		}
+	} else {
+		lex.expect("PARTS");
+		lex.expect(":");
+		while (!lex.is("}") && lex.type() != token_type::end)
+			c.parts.push_back(parse_part(lex));
+	}
+
+	lex.expect("}");
+	return c;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "chip.h"
+
+#include <string>
+
+namespace hdl {
+	/**
+	 * Parses a .hdl file:
+	 *
+	 *   CHIP Name {
+	 *       IN a, b[16];
+	 *       OUT out[16];
+	 *       PARTS:
+	 *       Part(pin=signal, pin[0..7]=signal[8..15], ...);
+	 *       ...
+	 *   }
+	 *
+	 * or, in place of PARTS:, "BUILTIN Name; CLOCKED a, b;" for a chip
+	 * implemented natively. Throws std::runtime_error naming the file and
+	 * line on a syntax error.
+	 */
+	chip parse_hdl(const std::string &file);
+} // namespace hdl
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace hdl {
+	// All the hardware threads, at least one.
+	inline unsigned default_threads()
+	{
+		unsigned threads = std::thread::hardware_concurrency();
+		return threads ? threads : 1;
+	}
+
+	/**
+	 * Runs work(0) .. work(items - 1) on a pool of threads. Each thread
+	 * takes the next item when done with its last, so a few long items
+	 * do not hold up the others. work must not throw.
+	 */
+	template<typename F>
+	void run_parallel(unsigned threads, std::size_t items, F work)
+	{
+		std::atomic<std::size_t> next(0);
+		auto worker = [&]() {
+			for (std::size_t i; (i = next++) < items; )
+				work(i);
+		};
+
+		std::vector<std::thread> pool;
+		for (unsigned t = 1; t < threads && t < items; t++)
+			pool.emplace_back(worker);
+		worker();
+		for (std::thread &t : pool)
+			t.join();
+	}
+} // namespace hdl
@@ -0,0 +1,155 @@
+#include "reference.h"
+
+using namespace hdl;
+
+namespace {
+	void not_(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = !in[0];
+	}
+
+	void and_(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = in[0] & in[1];
+	}
+
+	void or_(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = in[0] | in[1];
+	}
+
+	void xor_(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = in[0] ^ in[1];
+	}
+
+	void mux(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = in[2] ? in[1] : in[0];
+	}
+
+	void dmux(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = in[1] ? 0 : in[0];
+		out[1] = in[1] ? in[0] : 0;
+	}
+
+	void not16(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = ~in[0];
+	}
+
+	void or8way(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = in[0] != 0;
+	}
+
+	// a, b, ..., sel with as many ways as the template says.
+	template<unsigned Ways>
+	void mux_way(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = in[in[Ways]];
+	}
+
+	template<unsigned Ways>
+	void dmux_way(const uint16_t *in, uint16_t *out)
+	{
+		for (unsigned i = 0; i < Ways; i++)
+			out[i] = i == in[1] ? in[0] : 0;
+	}
+
+	void half_adder(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = in[0] ^ in[1];
+		out[1] = in[0] & in[1];
+	}
+
+	void full_adder(const uint16_t *in, uint16_t *out)
+	{
+		unsigned sum = in[0] + in[1] + in[2];
+		out[0] = sum & 1;
+		out[1] = sum >> 1;
+	}
+
+	void add16(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = in[0] + in[1];
+	}
+
+	void inc16(const uint16_t *in, uint16_t *out)
+	{
+		out[0] = in[0] + 1;
+	}
+
+	// x, y, zx, nx, zy, ny, f, no | out, zr, ng
+	void alu(const uint16_t *in, uint16_t *out)
+	{
+		uint16_t x = in[2] ? 0 : in[0];
+		uint16_t y = in[4] ? 0 : in[1];
+
+		if (in[3])
+			x = ~x;
+		if (in[5])
+			y = ~y;
+		uint16_t result = in[6] ? x + y : x & y;
+		if (in[7])
+			result = ~result;
+
+		out[0] = result;
+		out[1] = result == 0;
+		out[2] = result >> 15;
+	}
+
+	std::vector<pin> ways(unsigned count, unsigned width)
+	{
+		std::vector<pin> pins;
+		for (unsigned i = 0; i < count; i++)
+			pins.push_back(pin{ std::string(1, 'a' + i), width });
+		return pins;
+	}
+
+	template<typename T>
+	std::vector<T> operator+(std::vector<T> a, const std::vector<T> &b)
+	{
+		a.insert(a.end(), b.begin(), b.end());
+		return a;
+	}
+} // namespace
+
+const std::vector<reference> &hdl::references()
+{
+	static const std::vector<reference> table = {
+		{ "Not", { { "in", 1 } }, { { "out", 1 } }, not_ },
+		{ "And", ways(2, 1), { { "out", 1 } }, and_ },
+		{ "Or", ways(2, 1), { { "out", 1 } }, or_ },
+		{ "Xor", ways(2, 1), { { "out", 1 } }, xor_ },
+		{ "Mux", ways(2, 1) + std::vector<pin>{ { "sel", 1 } }, { { "out", 1 } }, mux },
+		{ "DMux", { { "in", 1 }, { "sel", 1 } }, ways(2, 1), dmux },
+		{ "Not16", { { "in", 16 } }, { { "out", 16 } }, not16 },
+		{ "And16", ways(2, 16), { { "out", 16 } }, and_ },
+		{ "Or16", ways(2, 16), { { "out", 16 } }, or_ },
+		{ "Mux16", ways(2, 16) + std::vector<pin>{ { "sel", 1 } }, { { "out", 16 } }, mux },
+		{ "Or8Way", { { "in", 8 } }, { { "out", 1 } }, or8way },
+		{ "Mux4Way16", ways(4, 16) + std::vector<pin>{ { "sel", 2 } }, { { "out", 16 } }, mux_way<4> },
+		{ "Mux8Way16", ways(8, 16) + std::vector<pin>{ { "sel", 3 } }, { { "out", 16 } }, mux_way<8> },
+		{ "DMux4Way", { { "in", 1 }, { "sel", 2 } }, ways(4, 1), dmux_way<4> },
+		{ "DMux8Way", { { "in", 1 }, { "sel", 3 } }, ways(8, 1), dmux_way<8> },
+		{ "HalfAdder", ways(2, 1), { { "sum", 1 }, { "carry", 1 } }, half_adder },
+		{ "FullAdder", ways(3, 1), { { "sum", 1 }, { "carry", 1 } }, full_adder },
+		{ "Add16", ways(2, 16), { { "out", 16 } }, add16 },
+		{ "Inc16", { { "in", 16 } }, { { "out", 16 } }, inc16 },
+		{ "ALU",
+		  { { "x", 16 }, { "y", 16 }, { "zx", 1 }, { "nx", 1 }, { "zy", 1 }, { "ny", 1 }, { "f", 1 }, { "no", 1 } },
+		  { { "out", 16 }, { "zr", 1 }, { "ng", 1 } },
+		  alu },
+	};
+	return table;
+}
+
+const reference *hdl::find_reference(const std::string &chip)
+{
+	for (const reference &r : references())
+		if (r.chip == chip)
+			return &r;
+	return nullptr;
+}
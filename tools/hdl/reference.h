@@ -0,0 +1,27 @@
+#pragma once
+
+#include "chip.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace hdl {
+	/**
+	 * What a combinational chip of projects 01 and 02 computes, written
+	 * directly in C++ to check the .hdl against. Pin values are passed in
+	 * the order of the declaration of the chip in the book.
+	 */
+	struct reference {
+		std::string chip;
+		std::vector<pin> inputs;
+		std::vector<pin> outputs;
+		void (*model)(const uint16_t *in, uint16_t *out);
+	};
+
+	// The reference models of all those chips.
+	const std::vector<reference> &references();
+
+	// The reference model of a chip, or null.
+	const reference *find_reference(const std::string &chip);
+} // namespace hdl
@@ -0,0 +1,568 @@
+#include "script.h"
+#include "library.h"
+#include "netlist.h"
+#include "simulator.h"
+
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+using namespace hdl;
+
+/**
+ * A script command as its words, e.g. { "set", "a", "%B01" }. repeat and
+ * while keep their arguments in words and the commands of the loop in
+ * body; repeat without a count runs forever.
+ */
+struct script::command {
+	std::vector<std::string> words;
+	std::vector<command> body;
+	std::size_t line;
+};
+
+// One output-list entry, name%Fleft.width.right.
+struct script::column {
+	std::string variable;
+	char format;
+	unsigned left, width, right;
+};
+
+namespace {
+	struct token {
+		std::string text;
+		bool quoted;
+		std::size_t line;
+	};
+
+	bool punctuation(char c)
+	{
+		return c == ',' || c == ';' || c == '!' || c == '{' || c == '}';
+	}
+
+	// Words, quoted strings and punctuation of a script, without comments.
+	std::vector<token> tokenize(const std::string &source)
+	{
+		std::vector<token> tokens;
+		std::size_t line = 1;
+
+		for (std::size_t i = 0; i < source.size(); ) {
+			char c = source[i];
+
+			if (c == '\n') {
+				line++;
+				i++;
+			} else if (std::isspace(static_cast<unsigned char>(c))) {
+				i++;
+			} else if (source.compare(i, 2, "//") == 0) {
+				while (i < source.size() && source[i] != '\n')
+					i++;
+			} else if (source.compare(i, 2, "/*") == 0) {
+				std::size_t end = source.find("*/", i + 2);
+				end = end == std::string::npos ? source.size() : end + 2;
+				for (; i < end; i++)
+					line += source[i] == '\n';
+			} else if (c == '"') {
+				std::size_t end = source.find('"', i + 1);
+				if (end == std::string::npos)
+					end = source.size();
+				tokens.push_back(token{ source.substr(i + 1, end - i - 1), true, line });
+				i = end + 1;
+			} else if (punctuation(c)) {
+				tokens.push_back(token{ std::string(1, c), false, line });
+				i++;
+			} else {
+				std::size_t begin = i;
+				while (i < source.size() && !std::isspace(static_cast<unsigned char>(source[i])) &&
+				       !punctuation(source[i]) && source[i] != '"')
+					i++;
+				tokens.push_back(token{ source.substr(begin, i - begin), false, line });
+			}
+		}
+		return tokens;
+	}
+
+	bool is(const token &t, const char *text)
+	{
+		return !t.quoted && t.text == text;
+	}
+
+	// Parses script values: 5, -5, %D-5, %B101, %XFF.
+	long parse_value(const std::string &text)
+	{
+		int base = 10;
+		std::size_t start = 0;
+
+		if (text.size() >= 2 && text[0] == '%') {
+			switch (text[1]) {
+			case 'B':
+				base = 2;
+				break;
+			case 'X':
+				base = 16;
+				break;
+			case 'D':
+				break;
+			default:
+				throw std::runtime_error("bad value " + text);
+			}
+			start = 2;
+		}
+
+		std::size_t used = 0;
+		long value;
+		try {
+			value = std::stol(text.substr(start), &used, base);
+		} catch (const std::exception &) {
+			throw std::runtime_error("bad value " + text);
+		}
+		if (start + used != text.size())
+			throw std::runtime_error("bad value " + text);
+		return value;
+	}
+
+	std::string trim(const std::string &s)
+	{
+		std::size_t begin = s.find_first_not_of(' ');
+		if (begin == std::string::npos)
+			return std::string();
+		return s.substr(begin, s.find_last_not_of(' ') - begin + 1);
+	}
+
+	std::vector<std::string> cells(const std::string &line)
+	{
+		std::vector<std::string> result;
+		std::size_t begin = line.find('|');
+
+		while (begin != std::string::npos) {
+			std::size_t end = line.find('|', begin + 1);
+			if (end == std::string::npos)
+				break;
+			result.push_back(trim(line.substr(begin + 1, end - begin - 1)));
+			begin = end;
+		}
+		return result;
+	}
+
+	bool matches(const std::string &line, const std::string &expected)
+	{
+		std::vector<std::string> got = cells(line), want = cells(expected);
+
+		if (got.size() != want.size())
+			return false;
+		for (std::size_t i = 0; i < got.size(); i++)
+			if (got[i] != want[i] && want[i].find_first_not_of('*') != std::string::npos)
+				return false;
+		return true;
+	}
+} // namespace
+
+script::script(const std::string &file, std::vector<std::string> path, engine e, model_policy models)
+	: m_file(file),
+	  m_path(std::move(path)),
+	  m_engine(e),
+	  m_models(std::move(models)),
+	  m_compare_fixed(false),
+	  m_keep_output(false),
+	  m_output_lines(0),
+	  m_time(0),
+	  m_half_cycle(false)
+{
+	fs::path dir = fs::path(file).parent_path();
+	m_dir = dir.empty() ? "." : dir.string();
+	parse();
+}
+
+script::~script() = default;
+
+void script::parse()
+{
+	std::ifstream ifs(m_file, std::ifstream::in | std::ifstream::binary);
+	if (!ifs)
+		throw std::runtime_error("cannot open " + m_file);
+
+	std::string source((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	std::vector<token> tokens = tokenize(source);
+	std::size_t pos = 0;
+
+	// Commands up to the end of the script or the closing brace of a loop.
+	auto fail = [this](std::size_t line, const std::string &message) {
+		throw std::runtime_error(m_file + ":" + std::to_string(line) + ": " + message);
+	};
+	std::function<std::vector<command>(bool)> sequence = [&](bool loop) {
+		std::vector<command> commands;
+
+		while (pos < tokens.size()) {
+			if (is(tokens[pos], "}")) {
+				if (!loop)
+					fail(tokens[pos].line, "unexpected '}'");
+				pos++;
+				return commands;
+			}
+			if (is(tokens[pos], ",") || is(tokens[pos], ";") || is(tokens[pos], "!")) {
+				pos++;
+				continue;
+			}
+
+			command c;
+			c.line = tokens[pos].line;
+			while (pos < tokens.size() && (tokens[pos].quoted || !punctuation(tokens[pos].text[0])))
+				c.words.push_back(tokens[pos++].text);
+
+			if (c.words[0] == "repeat" || c.words[0] == "while") {
+				if (pos == tokens.size() || !is(tokens[pos], "{"))
+					fail(c.line, "expected '{' after " + c.words[0]);
+				pos++;
+				c.body = sequence(true);
+			} else if (pos < tokens.size() && is(tokens[pos], "{"))
+				fail(c.line, "unexpected '{'");
+
+			commands.push_back(std::move(c));
+		}
+
+		if (loop)
+			fail(tokens.empty() ? 1 : tokens.back().line, "missing '}'");
+		return commands;
+	};
+
+	m_commands = sequence(false);
+}
+
+bool script::run(std::ostream &log)
+{
+	if (!execute(m_commands, log))
+		return false;
+
+	if (!m_compare.empty() && m_output_lines < m_compare.size())
+		log << "End of script - output ended at line " << m_output_lines << " of the compare file" << std::endl;
+	else if (!m_compare.empty())
+		log << "End of script - Comparison ended successfully" << std::endl;
+	else
+		log << "End of script" << std::endl;
+	return true;
+}
+
+void script::keep_output()
+{
+	m_keep_output = true;
+}
+
+const std::vector<std::string> &script::output_lines() const
+{
+	return m_lines;
+}
+
+void script::compare_to(std::vector<std::string> lines)
+{
+	m_compare = std::move(lines);
+	m_compare_fixed = true;
+}
+
+bool script::execute(const std::vector<command> &commands, std::ostream &log)
+{
+	for (const command &c : commands)
+		if (!execute(c, log))
+			return false;
+	return true;
+}
+
+bool script::execute(const command &c, std::ostream &log)
+{
+	const std::string &name = c.words[0];
+
+	if (name == "repeat") {
+		long count = c.words.size() > 1 ? parse_value(c.words[1]) : -1;
+		for (long i = 0; count < 0 || i < count; i++)
+			if (!execute(c.body, log))
+				return false;
+		return true;
+	}
+	if (name == "while") {
+		while (condition(c))
+			if (!execute(c.body, log))
+				return false;
+		return true;
+	}
+
+	try {
+		if (name == "load") {
+			load(c);
+		} else if (name == "output-file") {
+			if (c.words.size() != 2)
+				throw std::runtime_error("output-file needs a file name");
+			m_output.reset(new std::ofstream(resolve(c.words[1])));
+			if (!*m_output)
+				throw std::runtime_error("cannot write " + c.words[1]);
+		} else if (name == "compare-to") {
+			if (c.words.size() != 2)
+				throw std::runtime_error("compare-to needs a file name");
+			if (m_compare_fixed)
+				return true;
+			std::ifstream ifs(resolve(c.words[1]));
+			if (!ifs)
+				throw std::runtime_error("cannot open " + c.words[1]);
+			m_compare.clear();
+			for (std::string line; std::getline(ifs, line); ) {
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				m_compare.push_back(line);
+			}
+		} else if (name == "output-list") {
+			m_columns.clear();
+			std::string header("|");
+			for (std::size_t i = 1; i < c.words.size(); i++) {
+				const std::string &word = c.words[i];
+				std::size_t percent = word.find('%');
+				column col{ word.substr(0, percent), 'B', 1, 1, 1 };
+
+				if (percent == std::string::npos) {
+					unsigned width = 1;
+					value_of(col.variable, &width);
+					col.width = width;
+				} else if (std::sscanf(word.c_str() + percent + 1, "%c%u.%u.%u",
+				                       &col.format, &col.left, &col.width, &col.right) != 4 ||
+				           std::string("BDXS").find(col.format) == std::string::npos)
+					throw std::runtime_error("bad output format " + word);
+
+				unsigned size = col.left + col.width + col.right;
+				std::string title = col.variable.substr(0, size);
+				std::size_t left = (size - title.size()) / 2;
+				header += std::string(left, ' ') + title + std::string(size - title.size() - left, ' ') + "|";
+				m_columns.push_back(col);
+			}
+			return output(header, log);
+		} else if (name == "set") {
+			set(c);
+		} else if (name == "eval") {
+			sim(c).eval();
+		} else if (name == "tick") {
+			sim(c).tick();
+			m_half_cycle = true;
+		} else if (name == "tock") {
+			sim(c).tock();
+			m_half_cycle = false;
+			m_time++;
+		} else if (name == "output") {
+			std::string line("|");
+			for (const column &col : m_columns)
+				line += format(col) + "|";
+			return output(line, log);
+		} else if (name == "echo") {
+			if (c.words.size() > 1)
+				log << c.words[1] << std::endl;
+		} else if (name == "clear-echo" || name == "breakpoint" || name == "clear-breakpoints") {
+			// Only meaningful in the graphical simulator.
+		} else if (c.words.size() == 3 && m_netlist && m_netlist->find_part(name)) {
+			m_netlist->find_part(name)->model->command(c.words[1], resolve(c.words[2]));
+			m_simulator->refresh(*m_netlist->find_part(name));
+		} else
+			throw std::runtime_error("unknown command " + name);
+	} catch (const std::runtime_error &e) {
+		throw std::runtime_error(m_file + ":" + std::to_string(c.line) + ": " + e.what());
+	}
+
+	return true;
+}
+
+void script::load(const command &c)
+{
+	if (c.words.size() != 2)
+		throw std::runtime_error("load needs a file name");
+
+	m_simulator.reset();
+	m_library.reset(new library(m_path, m_models));
+	const chip &top = m_library->load(resolve(c.words[1]));
+	m_netlist.reset(new netlist(flatten(*m_library, top)));
+	m_simulator = make_simulator(*m_netlist, m_engine);
+}
+
+void script::set(const command &c)
+{
+	if (c.words.size() != 3)
+		throw std::runtime_error("set needs a variable and a value");
+
+	const std::string &variable = c.words[1];
+	const long value = parse_value(c.words[2]);
+	long index;
+
+	simulator &s = sim(c);
+	if (builtin_part *p = part(variable, index)) {
+		if (!p->model->write(index, value))
+			throw std::runtime_error("no such word " + variable);
+		s.refresh(*p);
+		return;
+	}
+
+	for (const pin &in : m_netlist->top->inputs)
+		if (in.name == variable) {
+			s.set(m_netlist->signals.at(variable), value);
+			return;
+		}
+	if (variable.find('[') != std::string::npos)
+		throw std::runtime_error("no builtin part for " + variable);
+	throw std::runtime_error(variable + " is not an input pin");
+}
+
+bool script::condition(const command &c)
+{
+	if (c.words.size() != 4)
+		throw std::runtime_error(m_file + ":" + std::to_string(c.line) + ": while needs a variable, an operator and a value");
+
+	const long left = value_of(c.words[1], nullptr);
+	const long right = parse_value(c.words[3]);
+	const std::string &op = c.words[2];
+
+	if (op == "=")
+		return left == right;
+	if (op == "<>")
+		return left != right;
+	if (op == "<")
+		return left < right;
+	if (op == ">")
+		return left > right;
+	if (op == "<=")
+		return left <= right;
+	if (op == ">=")
+		return left >= right;
+	throw std::runtime_error(m_file + ":" + std::to_string(c.line) + ": unknown operator " + op);
+}
+
+/**
+ * Writes a line to the output file and compares it with the compare
+ * file. The header of output-list counts as the first line.
+ */
+bool script::output(const std::string &line, std::ostream &log)
+{
+	if (m_output)
+		*m_output << line << "\n";
+	if (m_keep_output)
+		m_lines.push_back(line);
+
+	std::size_t number = ++m_output_lines;
+	if (m_compare.empty())
+		return true;
+
+	if (number > m_compare.size() || !matches(line, m_compare[number - 1])) {
+		if (m_output)
+			m_output->flush();
+		log << "Comparison failure at line " << number << std::endl;
+		if (number <= m_compare.size())
+			log << "expected: " << m_compare[number - 1] << std::endl;
+		log << "     got: " << line << std::endl;
+		return false;
+	}
+	return true;
+}
+
+std::string script::resolve(const std::string &file) const
+{
+	fs::path p(file);
+	return p.is_absolute() ? file : (fs::path(m_dir) / p).string();
+}
+
+simulator &script::sim(const command &c)
+{
+	if (!m_simulator)
+		throw std::runtime_error(c.words[0] + " before load");
+	return *m_simulator;
+}
+
+// The builtin part a variable like RAM16K[3] or PC[] refers to, if any.
+builtin_part *script::part(const std::string &variable, long &index)
+{
+	std::size_t bracket = variable.find('[');
+	if (!m_netlist || bracket == std::string::npos || variable.back() != ']')
+		return nullptr;
+
+	builtin_part *p = m_netlist->find_part(variable.substr(0, bracket));
+	if (!p)
+		return nullptr;
+
+	std::string inside = variable.substr(bracket + 1, variable.size() - bracket - 2);
+	index = inside.empty() ? -1 : parse_value(inside);
+	return p;
+}
+
+/**
+ * Value of a variable, signed if it is 16 bits wide as the simulator
+ * shows it, with its width in bits.
+ */
+long script::value_of(const std::string &variable, unsigned *width)
+{
+	unsigned bits = 16;
+	long value;
+	long index;
+
+	if (variable == "time") {
+		value = m_time;
+	} else if (builtin_part *p = part(variable, index)) {
+		uint16_t word;
+		if (!p->model->read(index, word))
+			throw std::runtime_error("no such word " + variable);
+		value = static_cast<int16_t>(word);
+	} else {
+		if (!m_netlist)
+			throw std::runtime_error("no chip loaded");
+		auto found = m_netlist->signals.find(variable);
+		if (found == m_netlist->signals.end())
+			throw std::runtime_error("unknown variable " + variable);
+		bits = found->second.size();
+		uint16_t raw = m_simulator->get(found->second);
+		value = bits == 16 ? static_cast<int16_t>(raw) : raw;
+	}
+
+	if (width)
+		*width = bits;
+	return value;
+}
+
+std::string script::format(const column &col)
+{
+	std::string text;
+
+	if (col.variable == "time") {
+		text = std::to_string(m_time) + (m_half_cycle ? "+" : "");
+	} else {
+		unsigned bits;
+		long value = value_of(col.variable, &bits);
+		uint16_t raw = value;
+
+		switch (col.format) {
+		case 'B':
+			for (unsigned i = col.width; i-- > 0; )
+				text += i < 16 && (raw >> i & 1) ? '1' : '0';
+			break;
+		case 'X': {
+			static const char digits[] = "0123456789ABCDEF";
+			for (unsigned i = col.width; i-- > 0; )
+				text += i < 4 ? digits[raw >> (4 * i) & 0xF] : '0';
+			break;
+		}
+		default:
+			text = std::to_string(value);
+			break;
+		}
+	}
+
+	if (text.size() < col.width)
+		text = col.format == 'S' ? text + std::string(col.width - text.size(), ' ')
+		                         : std::string(col.width - text.size(), ' ') + text;
+	return std::string(col.left, ' ') + text + std::string(col.right, ' ');
+}
+
+uint64_t script::cycles() const
+{
+	return m_time;
+}
+
+uint64_t script::evaluations() const
+{
+	return m_simulator ? m_simulator->evaluations() : 0;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "library.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hdl {
+	class simulator;
+	enum class engine;
+	struct netlist;
+	struct builtin_part;
+
+	/**
+	 * Runs a test script (.tst) of the hardware simulator of the book:
+	 *
+	 *   load And.hdl, output-file And.out, compare-to And.cmp,
+	 *   output-list a%B3.1.3 b%B3.1.3 out%B3.1.3;
+	 *   set a 0, set b 1, eval, output;
+	 *
+	 * with tick, tock, repeat n { ... }, while var op value { ... }, echo
+	 * and part commands such as "ROM32K load Max.hack". Variables are the
+	 * pins and internal buses of the loaded chip, time, and the words of
+	 * builtin parts, e.g. RAM16K[0] or PC[]. Files are relative to the
+	 * script.
+	 *
+	 * Every output line is compared with the same line of the compare
+	 * file as it is written; cells are compared without the padding around
+	 * them and a cell of '*' in the compare file matches anything. The
+	 * script stops at the first mismatch.
+	 */
+	class script {
+	public:
+		// Chips are searched in the directory of the loaded one, then in path,
+		// and simulated by the given engine, with models as the policy says.
+		script(const std::string &file, std::vector<std::string> path, engine e,
+		       model_policy models = model_policy());
+		~script();
+
+		// False if the output did not match the compare file.
+		bool run(std::ostream &log);
+
+		// Keeps the output lines for output_lines(), to compare two runs.
+		void keep_output();
+		const std::vector<std::string> &output_lines() const;
+		// Compares the output with lines instead of the compare file.
+		void compare_to(std::vector<std::string> lines);
+
+		// Clock cycles (tocks) run and gate evaluations so far.
+		uint64_t cycles() const;
+		uint64_t evaluations() const;
+
+	private:
+		struct command;
+		struct column;
+
+		std::string m_file;
+		std::string m_dir;
+		std::vector<std::string> m_path;
+		engine m_engine;
+		model_policy m_models;
+		std::vector<command> m_commands;
+
+		std::unique_ptr<library> m_library;
+		std::unique_ptr<netlist> m_netlist;
+		std::unique_ptr<simulator> m_simulator;
+
+		std::unique_ptr<std::ofstream> m_output;
+		std::vector<std::string> m_compare;
+		bool m_compare_fixed;
+		bool m_keep_output;
+		std::vector<std::string> m_lines;
+		std::size_t m_output_lines;
+		std::vector<column> m_columns;
+		uint64_t m_time;
+		bool m_half_cycle;
+
+		void parse();
+		bool execute(const std::vector<command> &commands, std::ostream &log);
+		bool execute(const command &c, std::ostream &log);
+
+		void load(const command &c);
+		void set(const command &c);
+		bool output(const std::string &line, std::ostream &log);
+		bool condition(const command &c);
+
+		std::string resolve(const std::string &file) const;
+		simulator &sim(const command &c);
+		builtin_part *part(const std::string &variable, long &index);
+		long value_of(const std::string &variable, unsigned *width);
+		std::string format(const column &col);
+	};
+} // namespace hdl
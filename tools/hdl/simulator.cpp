@@ -0,0 +1,27 @@
+#include "simulator.h"
+#include "events.h"
+#include "sweep.h"
+
+#include <stdexcept>
+
+using namespace hdl;
+
+simulator::~simulator() = default;
+
+engine hdl::parse_engine(const std::string &name)
+{
+	if (name == "events")
+		return engine::events;
+	if (name == "sweep")
+		return engine::sweep;
+	if (name == "compiled")
+		return engine::compiled;
+	throw std::runtime_error("unknown engine " + name + ", not events, sweep or compiled");
+}
+
+std::unique_ptr<simulator> hdl::make_simulator(netlist &n, engine e)
+{
+	if (e == engine::events)
+		return std::unique_ptr<simulator>(new event_simulator(n));
+	return std::unique_ptr<simulator>(new sweep_simulator(n, e == engine::compiled));
+}
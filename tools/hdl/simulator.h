@@ -0,0 +1,55 @@
+#pragma once
+
+#include "netlist.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace hdl {
+	/**
+	 * A netlist in simulation. The clock follows the hardware simulator of
+	 * the book: tick() is the rising edge, on which DFFs and clocked
+	 * builtin parts sample their inputs, and tock() the falling one, on
+	 * which their outputs change. Every wire starts out false.
+	 */
+	class simulator {
+	public:
+		virtual ~simulator();
+
+		virtual netlist &circuit() = 0;
+
+		virtual uint16_t get(const bus &b) const = 0;
+		// Sets the wires of b, an input.
+		virtual void set(const bus &b, uint16_t value) = 0;
+
+		virtual void eval() = 0;
+		virtual void tick() = 0;
+		virtual void tock() = 0;
+
+		// Reevaluates a builtin part whose state a script changed.
+		virtual void refresh(builtin_part &p) = 0;
+
+		// Gate and part evaluations so far.
+		virtual uint64_t evaluations() const = 0;
+	};
+
+	enum class engine {
+		// Only the gates whose inputs changed, see event_simulator.
+		events,
+		// Every gate once in a fixed order, see sweep_simulator.
+		sweep,
+		// The same order compiled to machine code.
+		compiled,
+	};
+
+	// Throws std::runtime_error for an unknown name.
+	engine parse_engine(const std::string &name);
+
+	/**
+	 * A simulator of n using the given engine. Throws std::runtime_error
+	 * if the engine cannot simulate n, like a sweep of a chip with a loop
+	 * without a DFF.
+	 */
+	std::unique_ptr<simulator> make_simulator(netlist &n, engine e);
+} // namespace hdl
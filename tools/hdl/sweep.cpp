@@ -0,0 +1,243 @@
+#include "sweep.h"
+
+#include <stdexcept>
+
+using namespace hdl;
+
+// The pins of one builtin part, read and written in the slots.
+class sweep_simulator::part_pins : public pins {
+public:
+	part_pins(sweep_simulator &sim, uint32_t part)
+		: m_values(sim.m_values),
+		  m_pins(sim.m_part_pins[part])
+	{
+	}
+
+	uint16_t get(std::size_t pin) const override
+	{
+		const bus &b = m_pins[pin];
+		uint16_t value = 0;
+		for (std::size_t i = 0; i < b.size(); i++)
+			value |= m_values[b[i]] << i;
+		return value;
+	}
+
+	void set(std::size_t pin, uint16_t value) override
+	{
+		const bus &b = m_pins[pin];
+		for (std::size_t i = 0; i < b.size(); i++)
+			m_values[b[i]] = value >> i & 1;
+	}
+
+private:
+	std::vector<uint8_t> &m_values;
+	const std::vector<bus> &m_pins;
+};
+
+/**
+ * Sorts the gates and parts by Kahn's algorithm a level at a time: level
+ * 0 reads only inputs, constants, DFFs and clocked part outputs, and
+ * level k + 1 what became ready once level k was placed.
+ */
+sweep_simulator::sweep_simulator(netlist &n, bool compile)
+	: m_netlist(n),
+	  m_slot(n.wires),
+	  m_values(n.wires, 0),
+	  m_dirty(true),
+	  m_evaluations(0)
+{
+	const uint32_t nands = n.nands.size();
+	const uint32_t nodes = nands + n.parts.size();
+	const uint32_t none = ~uint32_t(0);
+
+	std::vector<uint32_t> driver(n.wires, none);
+	for (uint32_t i = 0; i < nands; i++)
+		driver[n.nands[i].out] = i;
+	for (uint32_t i = 0; i < n.parts.size(); i++)
+		for (std::size_t pin = n.parts[i].clocked.size(); pin < n.parts[i].pins.size(); pin++)
+			for (wire w : n.parts[i].pins[pin])
+				driver[w] = nands + i;
+
+	// Nodes waiting for each node, and how many inputs each still waits for.
+	std::vector<std::vector<uint32_t>> waiting(nodes);
+	std::vector<uint32_t> missing(nodes, 0);
+	auto depend = [&](uint32_t node, wire w) {
+		if (driver[w] != none) {
+			waiting[driver[w]].push_back(node);
+			missing[node]++;
+		}
+	};
+	for (uint32_t i = 0; i < nands; i++) {
+		depend(i, n.nands[i].a);
+		depend(i, n.nands[i].b);
+	}
+	for (uint32_t i = 0; i < n.parts.size(); i++)
+		for (std::size_t pin = 0; pin < n.parts[i].clocked.size(); pin++)
+			if (!n.parts[i].clocked[pin])
+				for (wire w : n.parts[i].pins[pin])
+					depend(nands + i, w);
+
+	std::vector<uint32_t> order, level, next;
+	for (uint32_t node = 0; node < nodes; node++)
+		if (missing[node] == 0)
+			level.push_back(node);
+	while (!level.empty()) {
+		for (uint32_t node : level) {
+			order.push_back(node);
+			for (uint32_t reader : waiting[node])
+				if (--missing[reader] == 0)
+					next.push_back(reader);
+		}
+		level.swap(next);
+		next.clear();
+	}
+	if (order.size() != nodes)
+		throw std::runtime_error("chip " + n.top->name + " has a loop without a DFF");
+
+	// Wires no gate drives keep their order, the constants first.
+	uint32_t slots = 0;
+	for (wire w = 0; w < n.wires; w++)
+		if (driver[w] == none || driver[w] >= nands)
+			m_slot[w] = slots++;
+	m_first_gate = slots;
+	for (uint32_t node : order)
+		if (node < nands)
+			m_slot[n.nands[node].out] = slots++;
+
+	for (uint32_t node : order) {
+		if (node < nands) {
+			m_a.push_back(m_slot[n.nands[node].a]);
+			m_b.push_back(m_slot[n.nands[node].b]);
+		} else
+			m_steps.push_back(part_step{ m_a.size(), node - nands });
+	}
+
+	for (const builtin_part &p : n.parts) {
+		m_part_pins.emplace_back();
+		for (const bus &pin : p.pins) {
+			m_part_pins.back().emplace_back();
+			for (wire w : pin)
+				m_part_pins.back().back().push_back(m_slot[w]);
+		}
+	}
+	for (const dff &d : n.dffs) {
+		m_dff_in.push_back(m_slot[d.in]);
+		m_dff_out.push_back(m_slot[d.out]);
+	}
+	m_next.assign(n.dffs.size(), 0);
+
+	if (compile)
+		m_compiled.reset(new compiled_sweep(m_first_gate, m_a, m_b, m_steps));
+
+	m_values[m_slot[wire_true]] = 1;
+	eval();
+}
+
+sweep_simulator::~sweep_simulator() = default;
+
+netlist &sweep_simulator::circuit()
+{
+	return m_netlist;
+}
+
+uint16_t sweep_simulator::get(const bus &b) const
+{
+	uint16_t value = 0;
+	for (std::size_t i = 0; i < b.size(); i++)
+		value |= m_values[m_slot[b[i]]] << i;
+	return value;
+}
+
+void sweep_simulator::set(const bus &b, uint16_t value)
+{
+	for (std::size_t i = 0; i < b.size(); i++) {
+		uint8_t &slot = m_values[m_slot[b[i]]];
+		if (slot != (value >> i & 1)) {
+			slot = value >> i & 1;
+			m_dirty = true;
+		}
+	}
+}
+
+void sweep_simulator::gates(std::size_t begin, std::size_t end)
+{
+	uint8_t *v = m_values.data();
+	uint8_t *out = v + m_first_gate;
+	const uint32_t *a = m_a.data();
+	const uint32_t *b = m_b.data();
+
+	for (std::size_t i = begin; i < end; i++)
+		out[i] = !(v[a[i]] & v[b[i]]);
+}
+
+void sweep_simulator::evaluate_part(uint32_t part)
+{
+	part_pins pins(*this, part);
+	m_netlist.parts[part].model->eval(pins);
+}
+
+void sweep_simulator::evaluate_part(void *self, uint32_t part)
+{
+	static_cast<sweep_simulator *>(self)->evaluate_part(part);
+}
+
+void sweep_simulator::sweep()
+{
+	if (m_compiled) {
+		m_compiled->run(m_values.data(), &sweep_simulator::evaluate_part, this);
+	} else {
+		std::size_t done = 0;
+		for (const part_step &s : m_steps) {
+			gates(done, s.end);
+			evaluate_part(s.part);
+			done = s.end;
+		}
+		gates(done, m_a.size());
+	}
+	m_evaluations += m_a.size() + m_steps.size();
+}
+
+void sweep_simulator::eval()
+{
+	if (m_dirty)
+		sweep();
+	m_dirty = false;
+}
+
+void sweep_simulator::tick()
+{
+	eval();
+
+	for (std::size_t i = 0; i < m_next.size(); i++)
+		m_next[i] = m_values[m_dff_in[i]];
+
+	for (uint32_t i = 0; i < m_netlist.parts.size(); i++) {
+		part_pins pins(*this, i);
+		m_netlist.parts[i].model->tick(pins);
+	}
+}
+
+void sweep_simulator::tock()
+{
+	for (std::size_t i = 0; i < m_next.size(); i++)
+		m_values[m_dff_out[i]] = m_next[i];
+
+	for (uint32_t i = 0; i < m_netlist.parts.size(); i++) {
+		part_pins pins(*this, i);
+		m_netlist.parts[i].model->tock(pins);
+	}
+
+	m_dirty = true;
+	eval();
+}
+
+void sweep_simulator::refresh(builtin_part &)
+{
+	m_dirty = true;
+	eval();
+}
+
+uint64_t sweep_simulator::evaluations() const
+{
+	return m_evaluations;
+}
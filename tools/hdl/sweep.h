@@ -0,0 +1,62 @@
+#pragma once
+
+#include "compiled.h"
+#include "simulator.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace hdl {
+	/**
+	 * Levelized simulation of a netlist. The Nand gates and builtin parts
+	 * are sorted once so that each comes after everything driving its
+	 * inputs, level by level, and eval() evaluates all of them in that
+	 * order: one linear sweep with no queue, whatever changed.
+	 *
+	 * Wires are renumbered into slots so that the gates write consecutive
+	 * slots; gate i reads m_a[i] and m_b[i] and writes m_first_gate + i.
+	 * A sweep is skipped when no input, DFF or part changed since the last.
+	 */
+	class sweep_simulator : public simulator {
+	public:
+		// With compile, the sweep runs as machine code, see compiled_sweep.
+		sweep_simulator(netlist &n, bool compile);
+		~sweep_simulator();
+
+		netlist &circuit() override;
+
+		uint16_t get(const bus &b) const override;
+		void set(const bus &b, uint16_t value) override;
+
+		void eval() override;
+		void tick() override;
+		void tock() override;
+
+		void refresh(builtin_part &p) override;
+
+		uint64_t evaluations() const override;
+
+	private:
+		class part_pins;
+
+		netlist &m_netlist;
+		std::vector<uint32_t> m_slot;
+		std::vector<uint8_t> m_values;
+		uint32_t m_first_gate;
+		std::vector<uint32_t> m_a, m_b;
+		std::vector<part_step> m_steps;
+		// The pins of every builtin part as slots.
+		std::vector<std::vector<bus>> m_part_pins;
+		std::vector<uint32_t> m_dff_in, m_dff_out;
+		std::vector<uint8_t> m_next;
+		std::unique_ptr<compiled_sweep> m_compiled;
+		bool m_dirty;
+		uint64_t m_evaluations;
+
+		void sweep();
+		void gates(std::size_t begin, std::size_t end);
+		void evaluate_part(uint32_t part);
+		static void evaluate_part(void *self, uint32_t part);
+	};
+} // namespace hdl